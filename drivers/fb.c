@@ -1,6 +1,9 @@
 #include "fb.h"
 #include "mailbox.h"
+#include "mmu.h"
+#include "dma.h"
 #include "string.h"
+#include "fpsimd.h"
 
 static framebuffer_t fb;
 
@@ -135,6 +138,7 @@ static const uint8_t font8x8[][8] = {
 };
 
 bool fb_init(uint32_t width, uint32_t height, uint32_t depth) {
+    mailbox_lock();
     mbox[0]  = 35 * 4;
     mbox[1]  = 0;
 
@@ -174,6 +178,7 @@ bool fb_init(uint32_t width, uint32_t height, uint32_t depth) {
     mbox[29] = MBOX_TAG_LAST;
 
     if (!mailbox_call(MBOX_CH_PROP) || mbox[23] == 0) {
+        mailbox_unlock();
         return false;
     }
 
@@ -181,9 +186,12 @@ bool fb_init(uint32_t width, uint32_t height, uint32_t depth) {
     fb.height = mbox[6];
     fb.depth  = mbox[15];
     fb.pitch  = mbox[28];
-    fb.buffer = (uint8_t*)(uint64_t)(mbox[23] & 0x3FFFFFFF);
+    fb.buffer = (uint8_t*)dma_bus_to_phys(mbox[23]);
     fb.size   = mbox[24];
     fb.initialized = true;
+    mailbox_unlock();
+
+    mmu_map_range((uint64_t)fb.buffer, fb.size, MT_NORMAL_NC);
 
     return true;
 }
@@ -194,13 +202,24 @@ void fb_putpixel(uint32_t x, uint32_t y, uint32_t color) {
     *((uint32_t*)(fb.buffer + offset)) = color;
 }
 
+/* Rows are filled 64 bytes at a time with NEON; the last few pixels of
+   each row are written one by one. */
 void fb_fillrect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color) {
-    for (uint32_t j = y; j < y + h && j < fb.height; j++) {
-        for (uint32_t i = x; i < x + w && i < fb.width; i++) {
-            uint32_t offset = j * fb.pitch + i * (fb.depth / 8);
-            *((uint32_t*)(fb.buffer + offset)) = color;
-        }
+    if (!fb.initialized || x >= fb.width || y >= fb.height) return;
+    if (w > fb.width - x) w = fb.width - x;
+    if (h > fb.height - y) h = fb.height - y;
+
+    uint32_t bpp = fb.depth / 8;
+    size_t blocks = (size_t)w * bpp / FPSIMD_BLOCK_SIZE;
+    uint32_t bulk = blocks * FPSIMD_BLOCK_SIZE / bpp;
+
+    if (blocks) kernel_neon_begin();
+    for (uint32_t j = y; j < y + h; j++) {
+        uint32_t *row = (uint32_t*)(fb.buffer + j * fb.pitch + x * bpp);
+        if (blocks) neon_fill_blocks(row, color, blocks);
+        for (uint32_t i = bulk; i < w; i++) row[i] = color;
     }
+    if (blocks) kernel_neon_end();
 }
 
 void fb_clear(uint32_t color) {
@@ -248,8 +267,21 @@ void fb_scroll_up(uint32_t lines) {
     uint32_t pixel_lines = lines * 10;
     uint32_t move_size = (fb.height - pixel_lines) * bytes_per_line;
 
-    memcpy(fb.buffer, fb.buffer + pixel_lines * bytes_per_line, move_size);
-    memset(fb.buffer + move_size, 0, pixel_lines * bytes_per_line);
+    uint32_t clear_size = pixel_lines * bytes_per_line;
+    size_t move_blocks = move_size / FPSIMD_BLOCK_SIZE;
+    size_t clear_blocks = clear_size / FPSIMD_BLOCK_SIZE;
+    uint32_t move_bulk = move_blocks * FPSIMD_BLOCK_SIZE;
+    uint32_t clear_bulk = clear_blocks * FPSIMD_BLOCK_SIZE;
+
+    /* The source is always at least one text line ahead of the
+       destination, so a forward block copy is safe. */
+    kernel_neon_begin();
+    neon_copy_blocks(fb.buffer, fb.buffer + clear_size, move_blocks);
+    neon_fill_blocks(fb.buffer + move_size, 0, clear_blocks);
+    kernel_neon_end();
+
+    memcpy(fb.buffer + move_bulk, fb.buffer + clear_size + move_bulk, move_size - move_bulk);
+    memset(fb.buffer + move_size + clear_bulk, 0, clear_size - clear_bulk);
 }
 
 framebuffer_t *fb_get_info(void) {
@@ -2,6 +2,11 @@
 #include "timer.h"
 #include "uart.h"
 #include "task.h"
+#include "smp.h"
+#include "ipi.h"
+#include "mailbox.h"
+#include "fpsimd.h"
+#include "workqueue.h"
 
 extern void *exception_vector_table;
 
@@ -16,32 +21,82 @@ void irq_init(void) {
 
 void irq_enable(uint32_t irq) {
     if (irq < 32) {
-        mmio_write(IRQ_ENABLE_1, irq);
+        mmio_write(IRQ_ENABLE_1, 1U << irq);
+    } else if (irq < 64) {
+        mmio_write(IRQ_ENABLE_2, 1U << (irq - 32));
     } else {
-        mmio_write(IRQ_ENABLE_2, irq >> 5);
+        mmio_write(IRQ_ENABLE_BASIC, 1U << (irq - 64));
     }
 }
 
 void irq_disable(uint32_t irq) {
     if (irq < 32) {
-        mmio_write(IRQ_DISABLE_1, irq);
+        mmio_write(IRQ_DISABLE_1, 1U << irq);
+    } else if (irq < 64) {
+        mmio_write(IRQ_DISABLE_2, 1U << (irq - 32));
     } else {
-        mmio_write(IRQ_DISABLE_2, irq >> 5);
+        mmio_write(IRQ_DISABLE_BASIC, 1U << (irq - 64));
     }
 }
 
-uint64_t handle_irq_schedule(uint64_t sp) {
-    uint32_t pending = mmio_read(IRQ_PENDING_1);
+void handle_irq_schedule(void) {
+    uint32_t cpu = smp_cpu_id();
+    uint32_t source = mmio_read(LOCAL_IRQ_SOURCE(cpu));
+    bool resched = false;
+    percpu_t *pc = this_cpu();
+    pc->irqs++;
+    pc->irq_depth++;
 
-    if (pending & IRQ_TIMER1) {
+    if (source & LOCAL_IRQ_MAILBOX0) {
+        resched |= ipi_handle();
+    }
+
+    if (source & LOCAL_IRQ_CNTV) {
+        resched |= task_deadline_expired();
+    }
+
+    /* Peripheral interrupts are routed to core 0 only. */
+    if (source & LOCAL_IRQ_GPU) {
+        uint32_t basic = mmio_read(IRQ_BASIC_PENDING);
+        if (basic & IRQ_BASIC_UART) uart_handle_irq();
+        if (basic & IRQ_BASIC_MAILBOX) mailbox_handle_irq();
+    }
+
+#ifdef NO_HZ
+    /* Every core, core 0 included, runs its slice timer on CNTP. */
+    if (source & LOCAL_IRQ_CNTPNS) {
+        smp_timer_tick();
+        resched |= task_tick();
+    }
+#else
+    if (cpu != 0) {
+        if (source & LOCAL_IRQ_CNTPNS) {
+            smp_timer_tick();
+            resched |= task_tick();
+        }
+    } else if (mmio_read(IRQ_PENDING_1) & IRQ_TIMER1) {
         timer_handle_irq();
-        sp = task_schedule(sp);
+        pc->ticks++;
+        resched |= task_tick();
+    }
+#endif
+
+    /* Taken while this core was running tasklets: leave the rest, the
+       switch included, to the softirq_run() we interrupted. */
+    pc->irq_depth--;
+    if (pc->irq_depth) {
+        if (resched) pc->need_resched = 1;
+        return;
     }
 
-    return sp;
+    softirq_run();
+
+    /* Wakeups above flag need_resched rather than switching here. The
+       interrupted task resumes from this call, possibly on another core. */
+    if (resched || pc->need_resched) task_schedule();
 }
 
-uint64_t handle_sync_svc(uint64_t sp) {
+void handle_sync_svc(uint64_t sp) {
     uint64_t *frame = (uint64_t *)sp;
     uint64_t elr = frame[31];
     uint32_t esr;
@@ -49,8 +104,8 @@ uint64_t handle_sync_svc(uint64_t sp) {
 
     uint32_t ec = (esr >> 26) & 0x3F;
 
-    if (ec == 0x15) {
-        sp = task_schedule(sp);
+    if (ec == ESR_EC_FP_ACCESS && fpsimd_handle_trap()) {
+        /* Access is on now; the trapped instruction runs again. */
     } else {
         uart_puts("[PANIC] Synchronous exception at ");
         uart_puthex(elr);
@@ -59,8 +114,6 @@ uint64_t handle_sync_svc(uint64_t sp) {
         uart_puts("\n");
         while (1) {}
     }
-
-    return sp;
 }
 
 void handle_fiq(void) {
@@ -1,22 +1,82 @@
 #include "mailbox.h"
+#include "mmu.h"
+#include "dma.h"
+#include "irq.h"
+#include "sync.h"
+
+static volatile uint32_t __attribute__((aligned(64))) mbox_boot[MBOX_WORDS];
+volatile uint32_t *mbox = mbox_boot;
+static mutex_t mbox_mutex;
+static wait_queue_t mbox_wait;
+static volatile bool mbox_irq = false;
+
+void mailbox_lock(void) {
+    mutex_lock(&mbox_mutex);
+}
+
+void mailbox_unlock(void) {
+    mutex_unlock(&mbox_mutex);
+}
+
+void mailbox_init(void) {
+    mutex_init(&mbox_mutex, "mailbox");
+
+    uint32_t bus;
+    volatile uint32_t *buf = (volatile uint32_t*)dma_alloc_coherent(MBOX_WORDS * 4, &bus);
+    if (buf) mbox = buf;
+}
+
+void mailbox_irq_init(void) {
+    wait_queue_init(&mbox_wait, "mailbox");
+    mmio_write(MBOX_CONFIG, 0);
+    irq_enable(IRQ_NR_MAILBOX);
+    mbox_irq = true;
+}
+
+/* The interrupt stays asserted until the reply is read by the waiter. */
+void mailbox_handle_irq(void) {
+    mmio_write(MBOX_CONFIG, 0);
+    uint64_t flags = spin_lock_irqsave(&mbox_wait.lock);
+    wake_up_all_locked(&mbox_wait);
+    spin_unlock_irqrestore(&mbox_wait.lock, flags);
+}
+
+static bool mailbox_pending(void) {
+    return !(mmio_read(MBOX_STATUS) & MBOX_EMPTY);
+}
 
-volatile uint32_t __attribute__((aligned(16))) mbox[36];
+static void mailbox_wait_reply(void) {
+    if (mbox_irq && task_can_block()) {
+        mmio_write(MBOX_CONFIG, MBOX_CONFIG_DATA_IRQ);
+        wait_event(&mbox_wait, mailbox_pending());
+        mmio_write(MBOX_CONFIG, 0);
+        return;
+    }
+    while (!mailbox_pending()) {}
+}
 
 bool mailbox_call(uint8_t channel) {
-    uint32_t r = ((uint32_t)((uint64_t)&mbox) & ~0xF) | (channel & 0xF);
+    uint32_t r = (dma_phys_to_bus((uint64_t)mbox) & ~0xF) | (channel & 0xF);
+    bool cached = (mbox == mbox_boot);
+
+    if (cached) dcache_clean_invalidate_range((uint64_t)mbox, MBOX_WORDS * 4);
+    dma_wmb();
 
     while (mmio_read(MBOX_STATUS) & MBOX_FULL) {}
     mmio_write(MBOX_WRITE, r);
 
     while (1) {
-        while (mmio_read(MBOX_STATUS) & MBOX_EMPTY) {}
+        mailbox_wait_reply();
         if (mmio_read(MBOX_READ) == r) {
+            dma_rmb();
+            if (cached) dcache_clean_invalidate_range((uint64_t)mbox, MBOX_WORDS * 4);
             return mbox[1] == MBOX_RESPONSE;
         }
     }
 }
 
 uint32_t mailbox_get_board_revision(void) {
+    mailbox_lock();
     mbox[0] = 7 * 4;
     mbox[1] = 0;
     mbox[2] = MBOX_TAG_GETREVISION;
@@ -25,13 +85,13 @@ uint32_t mailbox_get_board_revision(void) {
     mbox[5] = 0;
     mbox[6] = MBOX_TAG_LAST;
 
-    if (mailbox_call(MBOX_CH_PROP)) {
-        return mbox[5];
-    }
-    return 0;
+    uint32_t ret = mailbox_call(MBOX_CH_PROP) ? mbox[5] : 0;
+    mailbox_unlock();
+    return ret;
 }
 
 uint64_t mailbox_get_serial(void) {
+    mailbox_lock();
     mbox[0] = 8 * 4;
     mbox[1] = 0;
     mbox[2] = MBOX_TAG_GETSERIAL;
@@ -41,13 +101,13 @@ uint64_t mailbox_get_serial(void) {
     mbox[6] = 0;
     mbox[7] = MBOX_TAG_LAST;
 
-    if (mailbox_call(MBOX_CH_PROP)) {
-        return ((uint64_t)mbox[6] << 32) | mbox[5];
-    }
-    return 0;
+    uint64_t ret = mailbox_call(MBOX_CH_PROP) ? ((uint64_t)mbox[6] << 32) | mbox[5] : 0;
+    mailbox_unlock();
+    return ret;
 }
 
 uint32_t mailbox_get_arm_memory(void) {
+    mailbox_lock();
     mbox[0] = 8 * 4;
     mbox[1] = 0;
     mbox[2] = MBOX_TAG_GETMEMORY;
@@ -57,13 +117,13 @@ uint32_t mailbox_get_arm_memory(void) {
     mbox[6] = 0;
     mbox[7] = MBOX_TAG_LAST;
 
-    if (mailbox_call(MBOX_CH_PROP)) {
-        return mbox[6];
-    }
-    return 0;
+    uint32_t ret = mailbox_call(MBOX_CH_PROP) ? mbox[6] : 0;
+    mailbox_unlock();
+    return ret;
 }
 
 uint32_t mailbox_get_temperature(void) {
+    mailbox_lock();
     mbox[0] = 8 * 4;
     mbox[1] = 0;
     mbox[2] = MBOX_TAG_GETTEMP;
@@ -73,13 +133,13 @@ uint32_t mailbox_get_temperature(void) {
     mbox[6] = 0;
     mbox[7] = MBOX_TAG_LAST;
 
-    if (mailbox_call(MBOX_CH_PROP)) {
-        return mbox[6];
-    }
-    return 0;
+    uint32_t ret = mailbox_call(MBOX_CH_PROP) ? mbox[6] : 0;
+    mailbox_unlock();
+    return ret;
 }
 
 uint32_t mailbox_get_max_temperature(void) {
+    mailbox_lock();
     mbox[0] = 8 * 4;
     mbox[1] = 0;
     mbox[2] = MBOX_TAG_GETMAXTEMP;
@@ -89,13 +149,13 @@ uint32_t mailbox_get_max_temperature(void) {
     mbox[6] = 0;
     mbox[7] = MBOX_TAG_LAST;
 
-    if (mailbox_call(MBOX_CH_PROP)) {
-        return mbox[6];
-    }
-    return 0;
+    uint32_t ret = mailbox_call(MBOX_CH_PROP) ? mbox[6] : 0;
+    mailbox_unlock();
+    return ret;
 }
 
 uint32_t mailbox_get_clock_rate(uint32_t clock_id) {
+    mailbox_lock();
     mbox[0] = 8 * 4;
     mbox[1] = 0;
     mbox[2] = MBOX_TAG_GETCLOCKRATE;
@@ -105,13 +165,13 @@ uint32_t mailbox_get_clock_rate(uint32_t clock_id) {
     mbox[6] = 0;
     mbox[7] = MBOX_TAG_LAST;
 
-    if (mailbox_call(MBOX_CH_PROP)) {
-        return mbox[6];
-    }
-    return 0;
+    uint32_t ret = mailbox_call(MBOX_CH_PROP) ? mbox[6] : 0;
+    mailbox_unlock();
+    return ret;
 }
 
 uint32_t mailbox_get_max_clock_rate(uint32_t clock_id) {
+    mailbox_lock();
     mbox[0] = 8 * 4;
     mbox[1] = 0;
     mbox[2] = MBOX_TAG_GETMAXCLOCK;
@@ -121,13 +181,13 @@ uint32_t mailbox_get_max_clock_rate(uint32_t clock_id) {
     mbox[6] = 0;
     mbox[7] = MBOX_TAG_LAST;
 
-    if (mailbox_call(MBOX_CH_PROP)) {
-        return mbox[6];
-    }
-    return 0;
+    uint32_t ret = mailbox_call(MBOX_CH_PROP) ? mbox[6] : 0;
+    mailbox_unlock();
+    return ret;
 }
 
 bool mailbox_set_clock_rate(uint32_t clock_id, uint32_t rate) {
+    mailbox_lock();
     mbox[0] = 9 * 4;
     mbox[1] = 0;
     mbox[2] = MBOX_TAG_SETCLOCKRATE;
@@ -138,5 +198,7 @@ bool mailbox_set_clock_rate(uint32_t clock_id, uint32_t rate) {
     mbox[7] = 0;
     mbox[8] = MBOX_TAG_LAST;
 
-    return mailbox_call(MBOX_CH_PROP);
+    bool ok = mailbox_call(MBOX_CH_PROP);
+    mailbox_unlock();
+    return ok;
 }
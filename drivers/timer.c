@@ -1,13 +1,12 @@
 #include "timer.h"
 #include "irq.h"
 
-static volatile uint64_t system_ticks = 0;
-
 void timer_init(void) {
-    system_ticks = 0;
+#ifndef NO_HZ
     uint32_t cur = mmio_read(TIMER_CLO);
     mmio_write(TIMER_C1, cur + TICK_INTERVAL);
-    irq_enable(IRQ_TIMER1);
+    irq_enable(IRQ_NR_TIMER1);
+#endif
 }
 
 uint64_t timer_get_ticks(void) {
@@ -28,12 +27,80 @@ void timer_sleep(uint32_t ms) {
 }
 
 void timer_handle_irq(void) {
-    system_ticks++;
     uint32_t cur = mmio_read(TIMER_CLO);
     mmio_write(TIMER_C1, cur + TICK_INTERVAL);
     mmio_write(TIMER_CS, TIMER_CS_M1);
 }
 
+/* Derived from the free-running counter rather than a tick count, so it
+   stays correct when ticks are skipped. */
 uint64_t timer_get_uptime_seconds(void) {
-    return system_ticks / 100;
+    return timer_get_ticks() / TIMER_FREQ;
+}
+
+/* One-shot wakeup on the calling core's virtual timer. `deadline` is in
+   system timer ticks, like timer_get_ticks(); a deadline already in the
+   past fires immediately. */
+void timer_deadline_arm(uint64_t deadline) {
+    uint64_t now = timer_get_ticks();
+    uint64_t delta = deadline > now ? deadline - now : 0;
+    uint64_t freq;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+
+    uint64_t tval = delta * freq / TIMER_FREQ;
+    if (tval > 0x7FFFFFFF) tval = 0x7FFFFFFF;
+    asm volatile("msr cntv_tval_el0, %0" :: "r"(tval));
+    asm volatile("msr cntv_ctl_el0, %0" :: "r"(1ULL));
+}
+
+void timer_deadline_cancel(void) {
+    asm volatile("msr cntv_ctl_el0, %0" :: "r"(0ULL));
+}
+
+/* The core's generic timer count: a system register read, with a finer
+   resolution than the system timer, and the same on every core. */
+uint64_t timer_counter(void) {
+    uint64_t count;
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(count) :: "memory");
+    return count;
+}
+
+uint64_t timer_counter_to_ns(uint64_t count) {
+    uint64_t freq;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    return count / freq * NSEC_PER_SEC + count % freq * NSEC_PER_SEC / freq;
+}
+
+#ifdef NO_HZ
+static uint64_t slice_interval(void) {
+    uint64_t freq;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    return freq * TICK_INTERVAL / TIMER_FREQ;
+}
+
+/* One-shot scheduler tick on the calling core's physical timer, due
+   `ticks` TICK_INTERVALs from now. */
+void timer_slice_arm(uint32_t ticks) {
+    uint64_t tval = slice_interval() * ticks;
+    if (tval > 0x7FFFFFFF) tval = 0x7FFFFFFF;
+    asm volatile("msr cntp_tval_el0, %0" :: "r"(tval));
+    asm volatile("msr cntp_ctl_el0, %0" :: "r"(1ULL));
+}
+
+void timer_slice_stop(void) {
+    asm volatile("msr cntp_ctl_el0, %0" :: "r"(0ULL));
+}
+
+uint64_t timer_slice_stamp(void) {
+    uint64_t now;
+    asm volatile("mrs %0, cntpct_el0" : "=r"(now));
+    return now;
+}
+
+/* Whole ticks since `stamp`, rounded up. */
+uint32_t timer_slice_elapsed(uint64_t stamp) {
+    uint64_t interval = slice_interval();
+    uint64_t elapsed = timer_slice_stamp() - stamp;
+    return (uint32_t)((elapsed + interval - 1) / interval);
 }
+#endif
@@ -1,5 +1,17 @@
 #include "uart.h"
 #include "gpio.h"
+#include "irq.h"
+#include "task.h"
+#include "sync.h"
+#include "workqueue.h"
+
+/* Filled by the RX interrupt; head and tail are guarded by rx_wait.lock. */
+static char rx_buf[UART_RX_BUF_SIZE];
+static uint32_t rx_head = 0;
+static uint32_t rx_tail = 0;
+static wait_queue_t rx_wait;
+static tasklet_t rx_tasklet;
+static volatile bool rx_irq = false;
 
 void uart_init(void) {
     mmio_write(UART0_CR, 0);
@@ -18,9 +30,65 @@ void uart_putc(char c) {
     mmio_write(UART0_DR, c);
 }
 
+/* Wakes readers after the interrupt has moved input into the ring. */
+static void uart_rx_wake(void *arg) {
+    UNUSED(arg);
+    wake_up_all(&rx_wait);
+}
+
+void uart_irq_init(void) {
+    wait_queue_init(&rx_wait, "uart_rx");
+    tasklet_init(&rx_tasklet, uart_rx_wake, NULL);
+    mmio_write(UART0_ICR, UART_INT_RX | UART_INT_RT);
+    mmio_write(UART0_IMSC, UART_INT_RX | UART_INT_RT);
+    irq_enable(IRQ_NR_UART);
+    rx_irq = true;
+}
+
+/* Drains the RX FIFO into the ring; bytes that do not fit are dropped.
+   Waking the readers is left to a tasklet. */
+void uart_handle_irq(void) {
+    uint64_t flags = spin_lock_irqsave(&rx_wait.lock);
+    while (!(mmio_read(UART0_FR) & UART_FR_RXFE)) {
+        char c = mmio_read(UART0_DR) & 0xFF;
+        if (rx_head - rx_tail < UART_RX_BUF_SIZE) rx_buf[rx_head++ % UART_RX_BUF_SIZE] = c;
+    }
+    mmio_write(UART0_ICR, UART_INT_RX | UART_INT_RT);
+    spin_unlock_irqrestore(&rx_wait.lock, flags);
+
+    tasklet_schedule(&rx_tasklet);
+}
+
+static bool rx_pop(char *c) {
+    if (rx_head == rx_tail) return false;
+    *c = rx_buf[rx_tail++ % UART_RX_BUF_SIZE];
+    return true;
+}
+
+bool uart_try_getc(char *c) {
+    if (!rx_irq) {
+        if (mmio_read(UART0_FR) & UART_FR_RXFE) return false;
+        *c = mmio_read(UART0_DR) & 0xFF;
+        return true;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&rx_wait.lock);
+    bool got = rx_pop(c);
+    spin_unlock_irqrestore(&rx_wait.lock, flags);
+    return got;
+}
+
 char uart_getc(void) {
-    while (mmio_read(UART0_FR) & UART_FR_RXFE) {}
-    return mmio_read(UART0_DR) & 0xFF;
+    char c;
+    if (rx_irq && task_can_block()) {
+        wait_event(&rx_wait, rx_pop(&c));
+        return c;
+    }
+
+    while (!uart_try_getc(&c)) {
+        if (task_scheduler_running()) task_yield();
+    }
+    return c;
 }
 
 void uart_puts(const char *s) {
@@ -31,6 +99,7 @@ void uart_puts(const char *s) {
 }
 
 bool uart_has_data(void) {
+    if (rx_irq) return rx_head != rx_tail;
     return !(mmio_read(UART0_FR) & UART_FR_RXFE);
 }
 
@@ -0,0 +1,112 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include "lareos.h"
+
+#ifdef __ARM_FEATURE_ATOMICS
+
+static inline uint32_t atomic_fetch_add32_acquire(volatile uint32_t *ptr, uint32_t val) {
+    uint32_t old;
+    asm volatile("ldadda %w2, %w0, %1" : "=r"(old), "+Q"(*ptr) : "r"(val) : "memory");
+    return old;
+}
+
+static inline void atomic_add32(volatile uint32_t *ptr, uint32_t val) {
+    asm volatile("stadd %w1, %0" : "+Q"(*ptr) : "r"(val) : "memory");
+}
+
+static inline void atomic_add64(volatile uint64_t *ptr, uint64_t val) {
+    asm volatile("stadd %1, %0" : "+Q"(*ptr) : "r"(val) : "memory");
+}
+
+static inline bool atomic_cmpxchg32_acquire(volatile uint32_t *ptr, uint32_t expected, uint32_t val) {
+    uint32_t old = expected;
+    asm volatile("casa %w0, %w2, %1" : "+r"(old), "+Q"(*ptr) : "r"(val) : "memory");
+    return old == expected;
+}
+
+#else
+
+static inline uint32_t atomic_fetch_add32_acquire(volatile uint32_t *ptr, uint32_t val) {
+    uint32_t old, tmp, fail;
+    asm volatile(
+        "1: ldaxr   %w0, %3\n"
+        "   add     %w1, %w0, %w4\n"
+        "   stxr    %w2, %w1, %3\n"
+        "   cbnz    %w2, 1b\n"
+        : "=&r"(old), "=&r"(tmp), "=&r"(fail), "+Q"(*ptr)
+        : "r"(val)
+        : "memory");
+    return old;
+}
+
+static inline void atomic_add32(volatile uint32_t *ptr, uint32_t val) {
+    uint32_t tmp, fail;
+    asm volatile(
+        "1: ldxr    %w0, %2\n"
+        "   add     %w0, %w0, %w3\n"
+        "   stxr    %w1, %w0, %2\n"
+        "   cbnz    %w1, 1b\n"
+        : "=&r"(tmp), "=&r"(fail), "+Q"(*ptr)
+        : "r"(val)
+        : "memory");
+}
+
+static inline void atomic_add64(volatile uint64_t *ptr, uint64_t val) {
+    uint64_t tmp;
+    uint32_t fail;
+    asm volatile(
+        "1: ldxr    %0, %2\n"
+        "   add     %0, %0, %3\n"
+        "   stxr    %w1, %0, %2\n"
+        "   cbnz    %w1, 1b\n"
+        : "=&r"(tmp), "=&r"(fail), "+Q"(*ptr)
+        : "r"(val)
+        : "memory");
+}
+
+static inline bool atomic_cmpxchg32_acquire(volatile uint32_t *ptr, uint32_t expected, uint32_t val) {
+    uint32_t old, fail;
+    asm volatile(
+        "1: ldaxr   %w0, %2\n"
+        "   cmp     %w0, %w3\n"
+        "   b.ne    2f\n"
+        "   stxr    %w1, %w4, %2\n"
+        "   cbnz    %w1, 1b\n"
+        "2:\n"
+        : "=&r"(old), "=&r"(fail), "+Q"(*ptr)
+        : "r"(expected), "r"(val)
+        : "memory", "cc");
+    return old == expected;
+}
+
+#endif
+
+static inline void atomic_sub32_release(volatile uint32_t *ptr, uint32_t val) {
+    uint32_t tmp, fail;
+    asm volatile(
+        "1: ldxr    %w0, %2\n"
+        "   sub     %w0, %w0, %w3\n"
+        "   stlxr   %w1, %w0, %2\n"
+        "   cbnz    %w1, 1b\n"
+        : "=&r"(tmp), "=&r"(fail), "+Q"(*ptr)
+        : "r"(val)
+        : "memory");
+}
+
+static inline void atomic_store32_release(volatile uint32_t *ptr, uint32_t val) {
+    asm volatile("stlr %w1, %0" : "=Q"(*ptr) : "r"(val) : "memory");
+}
+
+static inline uint64_t irq_save(void) {
+    uint64_t flags;
+    asm volatile("mrs %0, daif" : "=r"(flags));
+    asm volatile("msr daifset, #2" ::: "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+    asm volatile("msr daif, %0" :: "r"(flags) : "memory");
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include "lareos.h"
+#include "spinlock.h"
+#include "sync.h"
+
+#define CORO_YIELDED        0
+#define CORO_WAITING        1
+#define CORO_DONE           2
+
+#define EXECUTOR_TIMERS_INITIAL 16
+
+struct executor;
+typedef struct coroutine coro_t;
+typedef int (*coro_fn_t)(coro_t *co);
+
+/* A stackless coroutine: `fn` is re-entered from the top on every resume
+   and jumps to where it last suspended. Embed it at the start of a
+   structure holding whatever must survive a suspension point. */
+struct coroutine {
+    struct coroutine *next;
+    struct coroutine *wait_next;
+    struct executor *exec;
+    coro_fn_t fn;
+    void *arg;
+    uint64_t wake_at;
+    int32_t timer_index;
+    uint32_t resume;
+};
+
+/* `lock` guards the ready list, the timer heap and the counters. It is
+   a leaf: nothing else is taken under it. */
+typedef struct executor {
+    spinlock_t lock;
+    struct task *task;
+    bool idle;
+    coro_t *ready_head;
+    coro_t *ready_tail;
+    coro_t **timers;
+    uint32_t nr_timers;
+    uint32_t timer_cap;
+    uint32_t nr_coros;
+    uint32_t task_id;
+    uint64_t resumes;
+} executor_t;
+
+/* Protothread-style suspension points, at most one per source line.
+   Locals do not survive them, a switch statement must not enclose one,
+   and the body must never block: it would stall every coroutine on the
+   executor. Returning CORO_DONE ends the coroutine; the executor does
+   not touch it again, so `fn` may free it first. */
+#define CORO_BEGIN(co)      switch ((co)->resume) { case 0:
+#define CORO_END(co)        } return CORO_DONE
+
+#define CORO_YIELD(co)                                                  \
+    do {                                                                \
+        (co)->resume = __LINE__;                                        \
+        return CORO_YIELDED;                                            \
+        case __LINE__:;                                                 \
+    } while (0)
+
+#define CORO_SLEEP_US(co, us)                                           \
+    do {                                                                \
+        coro_sleep_setup((co), (us));                                   \
+        (co)->resume = __LINE__;                                        \
+        return CORO_WAITING;                                            \
+        case __LINE__:;                                                 \
+    } while (0)
+
+/* Suspends until `cond` holds. As with wait_event(), `cond` is evaluated
+   with wq->lock held and any wake_up() on `wq` resumes the coroutine. */
+#define CORO_WAIT_EVENT(co, wq, cond)                                   \
+    do {                                                                \
+        (co)->resume = __LINE__;                                        \
+        case __LINE__: {                                                \
+            uint64_t __cflags = spin_lock_irqsave(&(wq)->lock);         \
+            if (!(cond)) {                                              \
+                coro_wait_locked((co), (wq), __cflags);                 \
+                return CORO_WAITING;                                    \
+            }                                                           \
+            spin_unlock_irqrestore(&(wq)->lock, __cflags);              \
+        }                                                               \
+    } while (0)
+
+void coroutine_init(void);
+executor_t *executor_create(const char *name, uint8_t priority);
+executor_t *executor_default(void);
+
+void coro_init(coro_t *co, coro_fn_t fn, void *arg);
+bool coro_start(executor_t *exec, coro_t *co);
+void coro_wake(coro_t *co);
+void coro_sleep_setup(coro_t *co, uint64_t us);
+void coro_wait_locked(coro_t *co, wait_queue_t *wq, uint64_t flags);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef DMA_H
+#define DMA_H
+
+#include "lareos.h"
+
+#define DMA_POOL_SIZE       0x200000
+#define DMA_ALIGN           64
+#define DMA_GRANULES        (DMA_POOL_SIZE / DMA_ALIGN)
+
+#define BUS_ADDR_ALIAS      0xC0000000
+#define BUS_ADDR_MASK       0x3FFFFFFF
+
+/* Order Normal memory shared with a DMA master against the Device
+   accesses that hand it over: writes before the doorbell, reads after
+   the completion status. */
+static inline void dma_wmb(void) {
+    asm volatile("dsb sy" ::: "memory");
+}
+
+static inline void dma_rmb(void) {
+    asm volatile("dsb sy" ::: "memory");
+}
+
+void dma_init(void);
+void *dma_alloc_coherent(size_t size, uint32_t *bus_addr);
+void dma_free(void *ptr);
+uint32_t dma_phys_to_bus(uint64_t phys);
+uint64_t dma_bus_to_phys(uint32_t bus);
+uint32_t dma_get_free(void);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef FPSIMD_H
+#define FPSIMD_H
+
+#include "lareos.h"
+
+#define CPACR_FPEN_MASK     (3 << 20)
+#define CPACR_FPEN_NONE     (0 << 20)
+#define CPACR_FPEN_ALL      (3 << 20)
+
+#define ESR_EC_FP_ACCESS    0x07
+
+#define FPSIMD_BLOCK_SIZE   64
+
+typedef struct {
+    uint64_t q[64];
+    uint32_t fpsr;
+    uint32_t fpcr;
+} __attribute__((aligned(16))) fpsimd_state_t;
+
+struct task;
+
+void fpsimd_init_cpu(void);
+void fpsimd_init_task(struct task *task);
+bool fpsimd_handle_trap(void);
+void fpsimd_switch_out(struct task *prev);
+
+void kernel_neon_begin(void);
+void kernel_neon_end(void);
+
+extern void fpsimd_save_state(fpsimd_state_t *state);
+extern void fpsimd_load_state(const fpsimd_state_t *state);
+
+/* Bulk helpers for use between kernel_neon_begin() and kernel_neon_end();
+   each block is FPSIMD_BLOCK_SIZE bytes. */
+extern void neon_copy_blocks(void *dst, const void *src, size_t blocks);
+extern void neon_fill_blocks(void *dst, uint32_t pattern, size_t blocks);
+
+#endif
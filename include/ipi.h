@@ -0,0 +1,21 @@
+#ifndef IPI_H
+#define IPI_H
+
+#include "lareos.h"
+
+#define IPI_RESCHEDULE      (1 << 0)
+#define IPI_CALL_FUNC       (1 << 1)
+
+#define IPI_CALL_QUEUE      8
+
+typedef void (*ipi_func_t)(void *arg);
+
+void ipi_init_cpu(uint32_t cpu);
+void ipi_send(uint32_t cpu, uint32_t msg);
+void ipi_send_mask(uint32_t mask, uint32_t msg);
+bool ipi_handle(void);
+
+int smp_call_function(uint32_t cpu, ipi_func_t fn, void *arg, bool wait);
+int smp_call_function_many(uint32_t mask, ipi_func_t fn, void *arg, bool wait);
+
+#endif
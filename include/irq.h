@@ -18,6 +18,15 @@
 #define IRQ_TIMER3          (1 << 3)
 #define IRQ_UART            (1 << 25)
 
+#define IRQ_BASIC_MAILBOX   (1 << 1)
+#define IRQ_BASIC_UART      (1 << 19)
+
+/* Interrupt numbers for irq_enable()/irq_disable(): 0-63 are the GPU
+   interrupts, 64 and up the ARM basic interrupts. */
+#define IRQ_NR_TIMER1       1
+#define IRQ_NR_UART         57
+#define IRQ_NR_MAILBOX      65
+
 void irq_init(void);
 void irq_enable(uint32_t irq);
 void irq_disable(uint32_t irq);
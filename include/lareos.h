@@ -24,8 +24,10 @@ typedef int32_t             bool;
 
 #ifdef RPI4
     #define MMIO_BASE       0xFE000000
+    #define LOCAL_BASE      0xFF800000
 #else
     #define MMIO_BASE       0x3F000000
+    #define LOCAL_BASE      0x40000000
 #endif
 
 #define GPIO_BASE           (MMIO_BASE + 0x00200000)
@@ -14,6 +14,8 @@
 #define MBOX_EMPTY      0x40000000
 #define MBOX_RESPONSE   0x80000000
 
+#define MBOX_CONFIG_DATA_IRQ    (1 << 0)
+
 #define MBOX_CH_POWER   0
 #define MBOX_CH_FB      1
 #define MBOX_CH_VUART   2
@@ -44,11 +46,18 @@
 #define MBOX_TAG_SETPOWER       0x00028001
 #define MBOX_TAG_LAST           0
 
+#define MBOX_WORDS      36
+
 #define CLOCK_ID_EMMC   1
 #define CLOCK_ID_UART   2
 #define CLOCK_ID_ARM    3
 #define CLOCK_ID_CORE   4
 
+void mailbox_init(void);
+void mailbox_irq_init(void);
+void mailbox_handle_irq(void);
+void mailbox_lock(void);
+void mailbox_unlock(void);
 bool mailbox_call(uint8_t channel);
 uint32_t mailbox_get_board_revision(void);
 uint64_t mailbox_get_serial(void);
@@ -59,6 +68,6 @@ uint32_t mailbox_get_clock_rate(uint32_t clock_id);
 uint32_t mailbox_get_max_clock_rate(uint32_t clock_id);
 bool mailbox_set_clock_rate(uint32_t clock_id, uint32_t rate);
 
-extern volatile uint32_t __attribute__((aligned(16))) mbox[36];
+extern volatile uint32_t *mbox;
 
 #endif
@@ -4,7 +4,15 @@
 #include "lareos.h"
 
 #define PAGE_SIZE       4096
-#define MAX_PAGES       16384
+#define PAGE_MAX_ORDER  10
+
+#define SLAB_MIN_SIZE   16
+#define SLAB_MAX_SIZE   2048
+#define SLAB_PAGES      4
+
+#define ARENA_CHUNK_PAGES 4
+
+#define HEAP_PROFILE_SITES 256
 
 #define MEM_FREE        0
 #define MEM_USED        1
@@ -16,14 +24,55 @@ typedef struct {
     uint64_t free;
     uint32_t pages_total;
     uint32_t pages_used;
+    uint32_t free_blocks[PAGE_MAX_ORDER + 1];
+    uint64_t heap_total;
+    uint64_t heap_used;
+    uint64_t slab_used;
+    uint64_t largest_free;
+    uint64_t alloc_count;
+    uint64_t free_count;
 } mem_info_t;
 
+typedef struct kmem_cache kmem_cache_t;
+
+typedef struct {
+    uint64_t caller;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t live_count;
+    uint64_t live_bytes;
+    uint64_t peak_bytes;
+} heap_site_t;
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    uint32_t pages;
+} arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t *head;
+    arena_chunk_t *current;
+    uint64_t ptr;
+    uint64_t end;
+    uint32_t chunk_pages;
+} arena_t;
+
 void mm_init(void);
 void *kmalloc(size_t size);
 void *kcalloc(size_t count, size_t size);
+void *krealloc(void *ptr, size_t new_size);
+size_t ksize(void *ptr);
 void kfree(void *ptr);
 void *page_alloc(uint32_t count);
-void page_free(void *ptr, uint32_t count);
+void page_free(void *ptr);
+kmem_cache_t *kmem_cache_create(const char *name, size_t size);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *ptr);
+arena_t *arena_create(size_t chunk_size);
+void *arena_alloc(arena_t *arena, size_t size);
+void arena_reset(arena_t *arena);
+void arena_destroy(arena_t *arena);
 mem_info_t mm_get_info(void);
+int heap_profile_top(heap_site_t *out, int max);
 
 #endif
@@ -0,0 +1,23 @@
+#ifndef MMU_H
+#define MMU_H
+
+#include "lareos.h"
+
+#define MT_DEVICE_nGnRnE    0
+#define MT_DEVICE_nGnRE     1
+#define MT_NORMAL_NC        2
+#define MT_NORMAL           3
+
+#define MMU_BLOCK_SIZE      0x200000
+#define MMU_VA_LIMIT        0x100000000ULL
+
+void mmu_init(void);
+void mmu_enable(void);
+bool mmu_is_enabled(void);
+void mmu_map_range(uint64_t base, uint64_t size, uint32_t attr);
+
+void dcache_clean_range(uint64_t start, uint64_t size);
+void dcache_invalidate_range(uint64_t start, uint64_t size);
+void dcache_clean_invalidate_range(uint64_t start, uint64_t size);
+
+#endif
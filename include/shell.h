@@ -2,6 +2,7 @@
 #define SHELL_H
 
 #include "lareos.h"
+#include "mm.h"
 
 #define SHELL_MAX_CMD_LEN   256
 #define SHELL_MAX_ARGS      16
@@ -17,6 +18,8 @@ typedef struct {
 
 void shell_init(void);
 void shell_run(void);
+void shell_task(void *arg);
 void shell_register_command(const char *name, const char *desc, shell_cmd_fn handler);
+arena_t *shell_get_arena(void);
 
 #endif
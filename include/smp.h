@@ -0,0 +1,65 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "lareos.h"
+
+#define NR_CPUS                 4
+#define SMP_STACK_SIZE          16384
+
+#define CPU_OFFLINE             0
+#define CPU_STARTING            1
+#define CPU_ONLINE              2
+
+#define SPIN_TABLE_BASE         0xD8
+
+#define LOCAL_TIMER_CTRL(cpu)   (LOCAL_BASE + 0x40 + 4 * (cpu))
+#define LOCAL_IRQ_SOURCE(cpu)   (LOCAL_BASE + 0x60 + 4 * (cpu))
+#define LOCAL_IRQ_CNTPNS        (1 << 1)
+#define LOCAL_IRQ_CNTV          (1 << 3)
+#define LOCAL_IRQ_MAILBOX0      (1 << 4)
+#define LOCAL_IRQ_GPU           (1 << 8)
+
+#define LOCAL_MBOX_CTRL(cpu)    (LOCAL_BASE + 0x50 + 4 * (cpu))
+#define LOCAL_MBOX_SET(cpu, n)  (LOCAL_BASE + 0x80 + 0x10 * (cpu) + 4 * (n))
+#define LOCAL_MBOX_CLR(cpu, n)  (LOCAL_BASE + 0xC0 + 0x10 * (cpu) + 4 * (n))
+
+struct task;
+
+typedef struct {
+    uint32_t id;
+    volatile uint32_t state;
+    struct task *current;
+    struct task *idle;
+    struct task *prev;
+    struct task *dead;
+    uint64_t stack_top;
+    uint64_t online_at;
+    uint64_t slice_stamp;
+    volatile uint64_t ticks;
+    volatile uint64_t irqs;
+    volatile uint64_t idle_loops;
+    volatile uint64_t steals;
+    volatile uint64_t ipis;
+    volatile uint32_t need_resched;
+    uint32_t irq_depth;
+    struct task *fpsimd_owner;
+    struct task *fpsimd_last;
+    volatile uint64_t fpsimd_traps;
+} percpu_t;
+
+void smp_init(void);
+void smp_secondary_main(uint64_t cpu);
+void smp_cpu_idle(void);
+uint32_t smp_cpu_id(void);
+uint32_t smp_online_count(void);
+percpu_t *smp_get_cpu(uint32_t cpu);
+void smp_timer_tick(void);
+const char *smp_state_name(uint32_t state);
+
+static inline percpu_t *this_cpu(void) {
+    percpu_t *pc;
+    asm volatile("mrs %0, tpidr_el1" : "=r"(pc));
+    return pc;
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "lareos.h"
+#include "atomic.h"
+
+#define LOCK_STAT_MAX       64
+#define RWLOCK_WRITER       0x80000000U
+
+typedef struct {
+    const char *name;
+    volatile uint64_t acquired;
+    volatile uint64_t contended;
+} lock_stat_t;
+
+typedef struct {
+    union {
+        volatile uint32_t ticket;
+        struct {
+            volatile uint16_t owner;
+            volatile uint16_t next;
+        };
+    };
+    lock_stat_t stat;
+} spinlock_t;
+
+typedef struct {
+    volatile uint32_t count;
+    lock_stat_t stat;
+} rwlock_t;
+
+void spin_lock_init(spinlock_t *lock, const char *name);
+void spin_lock(spinlock_t *lock);
+bool spin_trylock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+uint64_t spin_lock_irqsave(spinlock_t *lock);
+void spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags);
+
+void rwlock_init(rwlock_t *lock, const char *name);
+void read_lock(rwlock_t *lock);
+void read_unlock(rwlock_t *lock);
+void write_lock(rwlock_t *lock);
+void write_unlock(rwlock_t *lock);
+uint64_t read_lock_irqsave(rwlock_t *lock);
+void read_unlock_irqrestore(rwlock_t *lock, uint64_t flags);
+uint64_t write_lock_irqsave(rwlock_t *lock);
+void write_unlock_irqrestore(rwlock_t *lock, uint64_t flags);
+
+int lock_stat_list(lock_stat_t **out, int max);
+
+#endif
@@ -12,6 +12,7 @@ char *strcat(char *dst, const char *src);
 char *strchr(const char *s, int c);
 void *memset(void *s, int c, size_t n);
 void *memcpy(void *dst, const void *src, size_t n);
+void *memmove(void *dst, const void *src, size_t n);
 int memcmp(const void *s1, const void *s2, size_t n);
 int atoi(const char *s);
 void itoa(int64_t val, char *buf, int base);
@@ -0,0 +1,71 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include "lareos.h"
+#include "spinlock.h"
+#include "task.h"
+
+#define PI_MAX_DEPTH        8
+
+struct coroutine;
+
+/* Tasks and stackless coroutines may both wait here; tasks are woken
+   first. */
+typedef struct wait_queue {
+    spinlock_t lock;
+    task_t *head;
+    struct coroutine *coro_head;
+    struct coroutine *coro_tail;
+} wait_queue_t;
+
+typedef struct mutex {
+    task_t *owner;
+    task_t *waiters;
+    struct mutex *next_held;
+    const char *name;
+} mutex_t;
+
+typedef struct {
+    wait_queue_t wait;
+    int32_t count;
+} semaphore_t;
+
+typedef struct {
+    wait_queue_t wait;
+} condvar_t;
+
+void sync_init(void);
+void sync_cancel_wait(task_t *task);
+
+void wait_queue_init(wait_queue_t *wq, const char *name);
+uint64_t wait_queue_wait_locked(wait_queue_t *wq, uint64_t flags);
+uint64_t wait_queue_wait_timeout_locked(wait_queue_t *wq, uint64_t flags, uint64_t deadline);
+bool wake_up_locked(wait_queue_t *wq);
+uint32_t wake_up_all_locked(wait_queue_t *wq);
+bool wake_up(wait_queue_t *wq);
+uint32_t wake_up_all(wait_queue_t *wq);
+
+/* `cond` is evaluated with wq->lock held. */
+#define wait_event(wq, cond)                                            \
+    do {                                                                \
+        uint64_t __wflags = spin_lock_irqsave(&(wq)->lock);             \
+        while (!(cond)) __wflags = wait_queue_wait_locked((wq), __wflags); \
+        spin_unlock_irqrestore(&(wq)->lock, __wflags);                  \
+    } while (0)
+
+void mutex_init(mutex_t *m, const char *name);
+void mutex_lock(mutex_t *m);
+bool mutex_trylock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+
+void sem_init(semaphore_t *sem, const char *name, int32_t count);
+void sem_wait(semaphore_t *sem);
+bool sem_trywait(semaphore_t *sem);
+void sem_post(semaphore_t *sem);
+
+void cond_init(condvar_t *cv, const char *name);
+void cond_wait(condvar_t *cv, mutex_t *m);
+void cond_signal(condvar_t *cv);
+void cond_broadcast(condvar_t *cv);
+
+#endif
@@ -2,8 +2,10 @@
 #define TASK_H
 
 #include "lareos.h"
+#include "smp.h"
+#include "fpsimd.h"
 
-#define MAX_TASKS           16
+#define TASK_STACK_POOL     16
 #define TASK_STACK_SIZE     16384
 #define TASK_NAME_LEN       32
 
@@ -14,16 +16,31 @@
 #define TASK_BLOCKED        4
 #define TASK_ZOMBIE         5
 
+#define TASK_PRIO_LEVELS    32
+#define TASK_PRIO_LOW       4
+#define TASK_PRIO_NORMAL    8
+#define TASK_PRIO_HIGH      16
+#define TASK_PRIO_MAX       (TASK_PRIO_LEVELS - 1)
+
+#define CPU_MASK_ALL        ((1U << NR_CPUS) - 1)
+#define CPU_MASK(cpu)       (1U << (cpu))
+
+/* x19-x28, fp, lr and sp as saved by context_switch(). Caller-saved
+   registers are dead across the call; a preempted task's full register
+   set is in the exception frame further up its own stack. */
 typedef struct {
-    uint64_t x[31];
+    uint64_t x[10];
+    uint64_t fp;
+    uint64_t lr;
     uint64_t sp;
-    uint64_t elr;
-    uint64_t spsr;
 } cpu_context_t;
 
 typedef void (*task_entry_t)(void *arg);
 
-typedef struct {
+struct wait_queue;
+struct mutex;
+
+typedef struct task {
     cpu_context_t context;
     uint8_t state;
     uint32_t id;
@@ -31,25 +48,78 @@ typedef struct {
     uint8_t *stack_base;
     uint32_t stack_size;
     uint64_t sleep_until;
+    int32_t sleep_index;
     uint64_t created_at;
-    uint64_t cpu_ticks;
+    uint64_t runtime_ns;
+    uint64_t wait_ns;
+    uint64_t acct_stamp;
+    uint64_t nvcsw;
+    uint64_t nivcsw;
+    uint8_t yielded;
     uint8_t priority;
+    uint8_t base_priority;
+    uint32_t slice_left;
     task_entry_t entry;
     void *arg;
+    uint32_t affinity;
+    uint32_t cpu;
+    volatile uint32_t on_cpu;
+    struct task *rq_next;
+    volatile uint8_t parked;
+    struct task *wait_next;
+    struct wait_queue *wait_queue;
+    struct mutex *blocked_on;
+    struct mutex *held_mutexes;
+    struct task *all_next;
+    struct task *all_prev;
+    uint32_t fpsimd_cpu;
+    fpsimd_state_t fpsimd;
 } task_t;
 
+/* A copy of one task's accounting, taken by task_get_stats(). */
+typedef struct {
+    uint32_t id;
+    char name[TASK_NAME_LEN];
+    uint8_t state;
+    uint8_t priority;
+    uint32_t cpu;
+    uint64_t runtime_ns;
+    uint64_t wait_ns;
+    uint64_t nvcsw;
+    uint64_t nivcsw;
+} task_stat_t;
+
 void task_init(void);
 int task_create(const char *name, task_entry_t entry, void *arg, uint8_t priority);
+int task_set_affinity(uint32_t id, uint32_t mask);
+int task_set_priority(uint32_t id, uint8_t priority);
+int task_set_timeslice(uint8_t priority, uint32_t ticks);
+uint32_t task_get_timeslice(uint8_t priority);
 void task_yield(void);
 void task_exit(void);
 void task_sleep_ms(uint32_t ms);
+void task_sleep_us(uint64_t us);
 int task_kill(uint32_t id);
 task_t *task_get_current(void);
-task_t *task_get_list(void);
+bool task_scheduler_running(void);
+void task_for_each(void (*fn)(task_t *task, void *arg), void *arg);
 int task_get_count(void);
-uint64_t task_schedule(uint64_t current_sp);
+int task_get_stats(task_stat_t *out, int max);
+const char *task_state_name(uint8_t state);
+uint32_t task_get_queue_length(uint32_t cpu);
+bool task_tick(void);
+bool task_deadline_expired(void);
+void task_schedule(void);
+void task_schedule_tail(void);
 void task_entry_wrapper(void);
+bool task_can_block(void);
+void task_check_preempt(void);
+void task_block(void);
+void task_block_until(uint64_t deadline);
+void task_wake(task_t *task);
+void task_boost_priority(task_t *task, uint8_t priority);
 
 extern void context_switch(cpu_context_t *old_ctx, cpu_context_t *new_ctx);
+extern void task_start(void);
 
 #endif
@@ -18,11 +18,23 @@
 
 #define TIMER_FREQ      1000000
 #define TICK_INTERVAL   (TIMER_FREQ / 100)
+#define NSEC_PER_SEC    1000000000ULL
 
 void timer_init(void);
 uint64_t timer_get_ticks(void);
 void timer_sleep(uint32_t ms);
 void timer_handle_irq(void);
 uint64_t timer_get_uptime_seconds(void);
+void timer_deadline_arm(uint64_t deadline);
+void timer_deadline_cancel(void);
+uint64_t timer_counter(void);
+uint64_t timer_counter_to_ns(uint64_t count);
+
+#ifdef NO_HZ
+void timer_slice_arm(uint32_t ticks);
+void timer_slice_stop(void);
+uint64_t timer_slice_stamp(void);
+uint32_t timer_slice_elapsed(uint64_t stamp);
+#endif
 
 #endif
@@ -19,9 +19,17 @@
 #define UART_FR_TXFF    (1 << 5)
 #define UART_FR_BUSY    (1 << 3)
 
+#define UART_INT_RX     (1 << 4)
+#define UART_INT_RT     (1 << 6)
+
+#define UART_RX_BUF_SIZE    256
+
 void uart_init(void);
 void uart_putc(char c);
 char uart_getc(void);
+bool uart_try_getc(char *c);
+void uart_irq_init(void);
+void uart_handle_irq(void);
 void uart_puts(const char *s);
 void uart_puthex(uint64_t val);
 void uart_putint(int64_t val);
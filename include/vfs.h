@@ -18,6 +18,8 @@
 #define VFS_O_APPEND    0x08
 #define VFS_O_TRUNC     0x10
 
+#define VFS_OFFSET_END  ((size_t)-1)
+
 typedef struct vfs_node {
     char name[VFS_MAX_NAME];
     uint8_t type;
@@ -30,6 +32,8 @@ typedef struct vfs_node {
     uint64_t created;
     uint64_t modified;
     uint32_t permissions;
+    volatile uint32_t refs;
+    bool unlinked;
     ssize_t (*read_fn)(struct vfs_node *node, void *buf, size_t size, size_t offset);
     ssize_t (*write_fn)(struct vfs_node *node, const void *buf, size_t size, size_t offset);
 } vfs_node_t;
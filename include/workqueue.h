@@ -0,0 +1,53 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include "lareos.h"
+
+#define WORKQUEUE_WORKERS   2
+
+#define TASKLET_SCHED       (1 << 0)
+#define TASKLET_RUN         (1 << 1)
+
+typedef void (*defer_fn_t)(void *arg);
+
+/* Runs on the CPU that scheduled it, at interrupt exit with IRQs enabled.
+   Must not block; a tasklet never runs on two cores at once. */
+typedef struct tasklet {
+    struct tasklet *next;
+    defer_fn_t fn;
+    void *arg;
+    volatile uint32_t state;
+    uint64_t queued_at;
+} tasklet_t;
+
+/* Runs in one of the target CPU's worker tasks and may block. */
+typedef struct work {
+    struct work *next;
+    defer_fn_t fn;
+    void *arg;
+    volatile uint32_t pending;
+    uint64_t queued_at;
+} work_t;
+
+typedef struct {
+    uint64_t queued;
+    uint64_t run;
+    uint64_t latency_ns;
+    uint64_t max_latency_ns;
+    uint32_t depth;
+    uint32_t max_depth;
+} defer_stats_t;
+
+void workqueue_init(void);
+
+void tasklet_init(tasklet_t *t, defer_fn_t fn, void *arg);
+bool tasklet_schedule(tasklet_t *t);
+void softirq_run(void);
+
+void work_init(work_t *work, defer_fn_t fn, void *arg);
+bool queue_work(work_t *work);
+bool queue_work_on(uint32_t cpu, work_t *work);
+
+void workqueue_get_stats(uint32_t cpu, defer_stats_t *tasklets, defer_stats_t *works);
+
+#endif
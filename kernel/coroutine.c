@@ -0,0 +1,236 @@
+#include "coroutine.h"
+#include "task.h"
+#include "mm.h"
+#include "string.h"
+#include "timer.h"
+
+/* A coroutine is in at most one place at a time: running, on its
+   executor's ready list, in its timer heap, or on a wait queue. Each
+   move hands it over under the lock of the place it is leaving, so a
+   wakeup can never queue it twice. */
+
+static executor_t *default_executor;
+
+static void ready_push(executor_t *exec, coro_t *co) {
+    co->next = NULL;
+    if (exec->ready_tail) exec->ready_tail->next = co;
+    else exec->ready_head = co;
+    exec->ready_tail = co;
+}
+
+static coro_t *ready_pop(executor_t *exec) {
+    coro_t *co = exec->ready_head;
+    exec->ready_head = co->next;
+    if (!exec->ready_head) exec->ready_tail = NULL;
+    co->next = NULL;
+    return co;
+}
+
+static void timer_set(executor_t *exec, uint32_t i, coro_t *co) {
+    exec->timers[i] = co;
+    co->timer_index = (int32_t)i;
+}
+
+static void timer_sift_up(executor_t *exec, uint32_t i) {
+    coro_t *co = exec->timers[i];
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (exec->timers[parent]->wake_at <= co->wake_at) break;
+        timer_set(exec, i, exec->timers[parent]);
+        i = parent;
+    }
+    timer_set(exec, i, co);
+}
+
+static void timer_sift_down(executor_t *exec, uint32_t i) {
+    coro_t *co = exec->timers[i];
+    uint32_t n = exec->nr_timers;
+    while (1) {
+        uint32_t child = 2 * i + 1;
+        if (child >= n) break;
+        if (child + 1 < n && exec->timers[child + 1]->wake_at < exec->timers[child]->wake_at) {
+            child++;
+        }
+        if (co->wake_at <= exec->timers[child]->wake_at) break;
+        timer_set(exec, i, exec->timers[child]);
+        i = child;
+    }
+    timer_set(exec, i, co);
+}
+
+static void timers_expire(executor_t *exec, uint64_t now) {
+    while (exec->nr_timers && exec->timers[0]->wake_at <= now) {
+        coro_t *co = exec->timers[0];
+        uint32_t last = --exec->nr_timers;
+        co->timer_index = -1;
+        if (last) {
+            timer_set(exec, 0, exec->timers[last]);
+            timer_sift_down(exec, 0);
+        }
+        ready_push(exec, co);
+    }
+}
+
+/* coro_sleep_setup() must never allocate. */
+static bool executor_reserve(executor_t *exec, uint32_t count) {
+    uint32_t cap = exec->timer_cap;
+    if (cap >= count) return true;
+    while (cap < count) cap *= 2;
+
+    coro_t **heap = (coro_t **)kmalloc(cap * sizeof(coro_t *));
+    if (!heap) return false;
+
+    uint64_t flags = spin_lock_irqsave(&exec->lock);
+    coro_t **old = heap;
+    if (exec->timer_cap < cap) {
+        memcpy(heap, exec->timers, exec->nr_timers * sizeof(coro_t *));
+        old = exec->timers;
+        exec->timers = heap;
+        exec->timer_cap = cap;
+    }
+    spin_unlock_irqrestore(&exec->lock, flags);
+    kfree(old);
+    return true;
+}
+
+/* As in wait_queue_wait_locked(), IRQs stay masked from the state change
+   to task_block*(); a wakeup in between just leaves the task READY. */
+static void executor_idle(executor_t *exec) {
+    task_t *self = exec->task;
+    self->state = TASK_BLOCKED;
+    exec->idle = true;
+    uint64_t deadline = exec->nr_timers ? exec->timers[0]->wake_at : 0;
+
+    spin_unlock(&exec->lock);
+    if (deadline) task_block_until(deadline);
+    else task_block();
+    spin_lock(&exec->lock);
+    exec->idle = false;
+}
+
+static void executor_task(void *arg) {
+    executor_t *exec = (executor_t *)arg;
+
+    uint64_t flags = spin_lock_irqsave(&exec->lock);
+    exec->task = task_get_current();
+    spin_unlock_irqrestore(&exec->lock, flags);
+
+    while (1) {
+        flags = spin_lock_irqsave(&exec->lock);
+        while (1) {
+            timers_expire(exec, timer_get_ticks());
+            if (exec->ready_head) break;
+            executor_idle(exec);
+        }
+        coro_t *co = ready_pop(exec);
+        exec->resumes++;
+        spin_unlock_irqrestore(&exec->lock, flags);
+
+        int ret = co->fn(co);
+
+        if (ret == CORO_YIELDED) {
+            flags = spin_lock_irqsave(&exec->lock);
+            ready_push(exec, co);
+            spin_unlock_irqrestore(&exec->lock, flags);
+        } else if (ret == CORO_DONE) {
+            flags = spin_lock_irqsave(&exec->lock);
+            exec->nr_coros--;
+            spin_unlock_irqrestore(&exec->lock, flags);
+        }
+    }
+}
+
+executor_t *executor_create(const char *name, uint8_t priority) {
+    executor_t *exec = (executor_t *)kmalloc(sizeof(executor_t));
+    if (!exec) return NULL;
+
+    memset(exec, 0, sizeof(executor_t));
+    spin_lock_init(&exec->lock, name);
+    exec->timers = (coro_t **)kmalloc(EXECUTOR_TIMERS_INITIAL * sizeof(coro_t *));
+    exec->timer_cap = EXECUTOR_TIMERS_INITIAL;
+    if (!exec->timers) {
+        kfree(exec);
+        return NULL;
+    }
+
+    int id = task_create(name, executor_task, exec, priority);
+    if (id < 0) {
+        kfree(exec->timers);
+        kfree(exec);
+        return NULL;
+    }
+    exec->task_id = (uint32_t)id;
+    return exec;
+}
+
+void coroutine_init(void) {
+    default_executor = executor_create("coroutines", TASK_PRIO_NORMAL);
+}
+
+executor_t *executor_default(void) {
+    return default_executor;
+}
+
+void coro_init(coro_t *co, coro_fn_t fn, void *arg) {
+    co->next = NULL;
+    co->wait_next = NULL;
+    co->exec = NULL;
+    co->fn = fn;
+    co->arg = arg;
+    co->wake_at = 0;
+    co->timer_index = -1;
+    co->resume = 0;
+}
+
+bool coro_start(executor_t *exec, coro_t *co) {
+    if (!exec) return false;
+
+    uint64_t flags = spin_lock_irqsave(&exec->lock);
+    uint32_t count = ++exec->nr_coros;
+    spin_unlock_irqrestore(&exec->lock, flags);
+
+    if (!executor_reserve(exec, count)) {
+        flags = spin_lock_irqsave(&exec->lock);
+        exec->nr_coros--;
+        spin_unlock_irqrestore(&exec->lock, flags);
+        return false;
+    }
+
+    co->exec = exec;
+    coro_wake(co);
+    return true;
+}
+
+/* Called with the wait queue's lock held, possibly from interrupt
+   context. Order: wait queue lock, exec->lock. */
+void coro_wake(coro_t *co) {
+    executor_t *exec = co->exec;
+    uint64_t flags = spin_lock_irqsave(&exec->lock);
+    ready_push(exec, co);
+    task_t *idle = exec->idle ? exec->task : NULL;
+    exec->idle = false;
+    spin_unlock_irqrestore(&exec->lock, flags);
+
+    if (idle) task_wake(idle);
+}
+
+/* Runs on the executor task itself, from CORO_SLEEP_US(). */
+void coro_sleep_setup(coro_t *co, uint64_t us) {
+    executor_t *exec = co->exec;
+    co->wake_at = timer_get_ticks() + us;
+
+    uint64_t flags = spin_lock_irqsave(&exec->lock);
+    uint32_t i = exec->nr_timers++;
+    timer_set(exec, i, co);
+    timer_sift_up(exec, i);
+    spin_unlock_irqrestore(&exec->lock, flags);
+}
+
+/* Queues `co` on `wq` and drops wq->lock, taken by CORO_WAIT_EVENT(). */
+void coro_wait_locked(coro_t *co, wait_queue_t *wq, uint64_t flags) {
+    co->wait_next = NULL;
+    if (wq->coro_tail) wq->coro_tail->wait_next = co;
+    else wq->coro_head = co;
+    wq->coro_tail = co;
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
@@ -0,0 +1,99 @@
+#include "dma.h"
+#include "mm.h"
+#include "mmu.h"
+#include "string.h"
+#include "spinlock.h"
+
+static uint64_t dma_base = 0;
+static uint64_t dma_bitmap[DMA_GRANULES / 64];
+static uint16_t dma_runs[DMA_GRANULES];
+static uint32_t dma_free_granules = 0;
+static spinlock_t dma_lock;
+
+static inline bool granule_used(uint32_t g) {
+    return dma_bitmap[g / 64] & (1ULL << (g % 64));
+}
+
+static void granules_mark(uint32_t first, uint32_t count, bool used) {
+    for (uint32_t g = first; g < first + count; g++) {
+        if (used) dma_bitmap[g / 64] |= 1ULL << (g % 64);
+        else dma_bitmap[g / 64] &= ~(1ULL << (g % 64));
+    }
+}
+
+uint32_t dma_phys_to_bus(uint64_t phys) {
+    return ((uint32_t)phys & BUS_ADDR_MASK) | BUS_ADDR_ALIAS;
+}
+
+uint64_t dma_bus_to_phys(uint32_t bus) {
+    return bus & BUS_ADDR_MASK;
+}
+
+void dma_init(void) {
+    void *pool = page_alloc(DMA_POOL_SIZE / PAGE_SIZE);
+    if (!pool) return;
+
+    dma_base = (uint64_t)pool;
+    spin_lock_init(&dma_lock, "dma");
+    mmu_map_range(dma_base, DMA_POOL_SIZE, MT_NORMAL_NC);
+
+    memset(dma_bitmap, 0, sizeof(dma_bitmap));
+    memset(dma_runs, 0, sizeof(dma_runs));
+    dma_free_granules = DMA_GRANULES;
+}
+
+void *dma_alloc_coherent(size_t size, uint32_t *bus_addr) {
+    if (!dma_base || size == 0) return NULL;
+
+    uint32_t count = ALIGN(size, DMA_ALIGN) / DMA_ALIGN;
+    uint64_t flags = spin_lock_irqsave(&dma_lock);
+    if (count > dma_free_granules) {
+        spin_unlock_irqrestore(&dma_lock, flags);
+        return NULL;
+    }
+
+    uint32_t run = 0;
+    for (uint32_t g = 0; g < DMA_GRANULES; g++) {
+        if ((g % 64) == 0 && dma_bitmap[g / 64] == ~0ULL) {
+            run = 0;
+            g += 63;
+            continue;
+        }
+
+        run = granule_used(g) ? 0 : run + 1;
+        if (run == count) {
+            uint32_t first = g + 1 - count;
+            granules_mark(first, count, true);
+            dma_runs[first] = count;
+            dma_free_granules -= count;
+            spin_unlock_irqrestore(&dma_lock, flags);
+
+            uint64_t addr = dma_base + (uint64_t)first * DMA_ALIGN;
+            memset((void*)addr, 0, (size_t)count * DMA_ALIGN);
+            if (bus_addr) *bus_addr = dma_phys_to_bus(addr);
+            return (void*)addr;
+        }
+    }
+    spin_unlock_irqrestore(&dma_lock, flags);
+    return NULL;
+}
+
+void dma_free(void *ptr) {
+    uint64_t addr = (uint64_t)ptr;
+    if (!ptr || addr < dma_base || addr >= dma_base + DMA_POOL_SIZE) return;
+    if ((addr - dma_base) % DMA_ALIGN) return;
+
+    uint32_t first = (addr - dma_base) / DMA_ALIGN;
+    uint64_t flags = spin_lock_irqsave(&dma_lock);
+    uint32_t count = dma_runs[first];
+    if (count) {
+        granules_mark(first, count, false);
+        dma_runs[first] = 0;
+        dma_free_granules += count;
+    }
+    spin_unlock_irqrestore(&dma_lock, flags);
+}
+
+uint32_t dma_get_free(void) {
+    return dma_free_granules * DMA_ALIGN;
+}
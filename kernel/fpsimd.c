@@ -0,0 +1,96 @@
+#include "fpsimd.h"
+#include "task.h"
+#include "smp.h"
+#include "atomic.h"
+
+/* The kernel is built with -mgeneral-regs-only, so q0-q31 only ever hold
+   values inside kernel_neon_begin()/kernel_neon_end() sections or SIMD
+   assembly. Access traps until a task first touches the unit; only such
+   tasks have their registers saved when they leave the CPU, and a task
+   that comes back to a CPU whose registers still hold its state skips
+   the reload. */
+
+static void fpsimd_set_access(uint64_t fpen) {
+    uint64_t cpacr;
+    asm volatile("mrs %0, cpacr_el1" : "=r"(cpacr));
+    cpacr = (cpacr & ~(uint64_t)CPACR_FPEN_MASK) | fpen;
+    asm volatile("msr cpacr_el1, %0; isb" :: "r"(cpacr));
+}
+
+void fpsimd_init_cpu(void) {
+    percpu_t *pc = this_cpu();
+    pc->fpsimd_owner = NULL;
+    pc->fpsimd_last = NULL;
+    fpsimd_set_access(CPACR_FPEN_NONE);
+}
+
+void fpsimd_init_task(task_t *task) {
+    task->fpsimd_cpu = NR_CPUS;
+}
+
+/* FP state belongs to the current task unless we are in an interrupt
+   handler or the scheduler has not started yet. */
+static bool fpsimd_task_context(percpu_t *pc) {
+    return task_scheduler_running() && pc->current && pc->irq_depth == 0;
+}
+
+static void fpsimd_acquire(percpu_t *pc, task_t *task) {
+    fpsimd_set_access(CPACR_FPEN_ALL);
+    if (pc->fpsimd_owner == task) return;
+
+    if (pc->fpsimd_last != task || task->fpsimd_cpu != pc->id) {
+        fpsimd_load_state(&task->fpsimd);
+        pc->fpsimd_last = task;
+        task->fpsimd_cpu = pc->id;
+    }
+    pc->fpsimd_owner = task;
+}
+
+/* Called from the synchronous exception handler on a trapped FP/SIMD
+   instruction, which is then re-executed. */
+bool fpsimd_handle_trap(void) {
+    percpu_t *pc = this_cpu();
+    if (!fpsimd_task_context(pc)) return false;
+
+    pc->fpsimd_traps++;
+    fpsimd_acquire(pc, pc->current);
+    return true;
+}
+
+/* Called from task_schedule() while `prev` still has on_cpu set, so no
+   other core can pick it up before its registers are in memory. */
+void fpsimd_switch_out(task_t *prev) {
+    percpu_t *pc = this_cpu();
+    if (pc->fpsimd_owner != prev) return;
+
+    fpsimd_save_state(&prev->fpsimd);
+    pc->fpsimd_owner = NULL;
+    fpsimd_set_access(CPACR_FPEN_NONE);
+}
+
+/* In task context the registers are simply the current task's, so the
+   section may be preempted like any other code. In an interrupt handler
+   the interrupted task's state is written back first; it traps and
+   reloads when it next touches the unit. */
+void kernel_neon_begin(void) {
+    uint64_t flags = irq_save();
+    percpu_t *pc = this_cpu();
+
+    if (fpsimd_task_context(pc)) {
+        fpsimd_acquire(pc, pc->current);
+    } else {
+        task_t *owner = pc->fpsimd_owner;
+        if (owner) fpsimd_save_state(&owner->fpsimd);
+        pc->fpsimd_owner = NULL;
+        pc->fpsimd_last = NULL;
+        fpsimd_set_access(CPACR_FPEN_ALL);
+    }
+    irq_restore(flags);
+}
+
+void kernel_neon_end(void) {
+    uint64_t flags = irq_save();
+    percpu_t *pc = this_cpu();
+    if (!fpsimd_task_context(pc)) fpsimd_set_access(CPACR_FPEN_NONE);
+    irq_restore(flags);
+}
@@ -0,0 +1,137 @@
+#include "ipi.h"
+#include "smp.h"
+#include "spinlock.h"
+
+typedef struct {
+    ipi_func_t fn;
+    void *arg;
+    volatile uint32_t *done;
+} ipi_call_t;
+
+typedef struct {
+    spinlock_t lock;
+    ipi_call_t calls[IPI_CALL_QUEUE];
+    uint32_t head;
+    uint32_t count;
+} ipi_queue_t;
+
+static ipi_queue_t call_queues[NR_CPUS];
+
+static const char *ipi_names[NR_CPUS] = { "ipi0", "ipi1", "ipi2", "ipi3" };
+
+void ipi_init_cpu(uint32_t cpu) {
+    ipi_queue_t *q = &call_queues[cpu];
+    spin_lock_init(&q->lock, ipi_names[cpu]);
+    q->head = 0;
+    q->count = 0;
+
+    mmio_write(LOCAL_MBOX_CLR(cpu, 0), 0xFFFFFFFF);
+    mmio_write(LOCAL_MBOX_CTRL(cpu), 1 << 0);
+}
+
+void ipi_send(uint32_t cpu, uint32_t msg) {
+    if (cpu >= NR_CPUS || smp_get_cpu(cpu)->state != CPU_ONLINE) return;
+    asm volatile("dsb ish" ::: "memory");
+    mmio_write(LOCAL_MBOX_SET(cpu, 0), msg);
+}
+
+void ipi_send_mask(uint32_t mask, uint32_t msg) {
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (mask & (1U << cpu)) ipi_send(cpu, msg);
+    }
+}
+
+static void run_calls(uint32_t cpu) {
+    ipi_queue_t *q = &call_queues[cpu];
+    ipi_call_t pending[IPI_CALL_QUEUE];
+    uint32_t n = 0;
+
+    spin_lock(&q->lock);
+    while (q->count) {
+        pending[n++] = q->calls[q->head];
+        q->head = (q->head + 1) % IPI_CALL_QUEUE;
+        q->count--;
+    }
+    spin_unlock(&q->lock);
+
+    for (uint32_t i = 0; i < n; i++) {
+        pending[i].fn(pending[i].arg);
+        if (pending[i].done) atomic_store32_release(pending[i].done, 1);
+    }
+}
+
+/* Called from the IRQ handler with IRQs masked. Returns true when the
+   sender asked this core to run the scheduler. */
+bool ipi_handle(void) {
+    uint32_t cpu = smp_cpu_id();
+    uint32_t msg = mmio_read(LOCAL_MBOX_CLR(cpu, 0));
+    if (!msg) return false;
+
+    mmio_write(LOCAL_MBOX_CLR(cpu, 0), msg);
+    this_cpu()->ipis++;
+
+    if (msg & IPI_CALL_FUNC) run_calls(cpu);
+    return (msg & IPI_RESCHEDULE) != 0;
+}
+
+static int queue_call(uint32_t cpu, ipi_func_t fn, void *arg, volatile uint32_t *done) {
+    ipi_queue_t *q = &call_queues[cpu];
+
+    while (1) {
+        uint64_t flags = spin_lock_irqsave(&q->lock);
+        if (q->count < IPI_CALL_QUEUE) {
+            ipi_call_t *call = &q->calls[(q->head + q->count) % IPI_CALL_QUEUE];
+            call->fn = fn;
+            call->arg = arg;
+            call->done = done;
+            q->count++;
+            spin_unlock_irqrestore(&q->lock, flags);
+            ipi_send(cpu, IPI_CALL_FUNC);
+            return 0;
+        }
+        spin_unlock_irqrestore(&q->lock, flags);
+        asm volatile("yield");
+    }
+}
+
+int smp_call_function_many(uint32_t mask, ipi_func_t fn, void *arg, bool wait) {
+    if (!fn) return -1;
+
+    uint64_t daif;
+    asm volatile("mrs %0, daif" : "=r"(daif));
+    /* Waiting with IRQs masked deadlocks if the target is waiting on us. */
+    if (wait && (daif & (1 << 7))) return -1;
+
+    uint32_t self = smp_cpu_id();
+    volatile uint32_t done[NR_CPUS];
+    int sent = 0;
+
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        done[cpu] = 1;
+        if (!(mask & (1U << cpu))) continue;
+
+        if (cpu == self) {
+            uint64_t flags = irq_save();
+            fn(arg);
+            irq_restore(flags);
+            continue;
+        }
+        if (smp_get_cpu(cpu)->state != CPU_ONLINE) continue;
+
+        done[cpu] = 0;
+        queue_call(cpu, fn, arg, wait ? &done[cpu] : NULL);
+        sent++;
+    }
+
+    if (wait) {
+        for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+            while (!done[cpu]) asm volatile("yield");
+        }
+    }
+    return sent;
+}
+
+int smp_call_function(uint32_t cpu, ipi_func_t fn, void *arg, bool wait) {
+    if (cpu >= NR_CPUS) return -1;
+    return smp_call_function_many(1U << cpu, fn, arg, wait);
+}
@@ -3,8 +3,16 @@
 #include "gpio.h"
 #include "timer.h"
 #include "irq.h"
+#include "mmu.h"
 #include "mm.h"
 #include "mailbox.h"
+#include "dma.h"
+#include "smp.h"
+#include "task.h"
+#include "sync.h"
+#include "workqueue.h"
+#include "coroutine.h"
+#include "vfs.h"
 #include "fb.h"
 #include "power.h"
 #include "shell.h"
@@ -29,10 +37,29 @@ static void boot_sequence(void) {
 
     boot_log("UART initialized");
 
+    mmu_init();
+    boot_log("MMU and caches enabled");
+
     mm_init();
     boot_log("Memory manager initialized");
 
+    dma_init();
+    mailbox_init();
+    boot_log("DMA pool initialized");
+
+    vfs_init();
+    boot_log("Virtual filesystem mounted");
+
+    smp_init();
+    uart_puts("\033[32m[  OK]\033[0m  CPU cores online: ");
+    uart_putuint(smp_online_count());
+    uart_puts("/");
+    uart_putuint(NR_CPUS);
+    uart_puts("\n");
+
     irq_init();
+    uart_irq_init();
+    mailbox_irq_init();
     boot_log("Interrupt controller initialized");
 
     timer_init();
@@ -88,6 +115,16 @@ static void boot_sequence(void) {
         uart_puts("\033[33m[WARN]\033[0m  Framebuffer not available\n");
     }
 
+    sync_init();
+    task_init();
+    boot_log("Scheduler started");
+
+    workqueue_init();
+    boot_log("Worker pools started");
+
+    coroutine_init();
+    boot_log("Coroutine executor started");
+
     boot_log("Boot complete");
 
     uart_puts("\n━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
@@ -98,5 +135,12 @@ void kernel_main(void) {
     boot_sequence();
 
     shell_init();
-    shell_run();
+
+    if (task_create("shell", shell_task, NULL, TASK_PRIO_HIGH) < 0) {
+        uart_puts("\033[31m[FAIL]\033[0m  Could not start shell task\n");
+        shell_run();
+    }
+
+    task_yield();
+    smp_cpu_idle();
 }
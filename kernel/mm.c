@@ -1,35 +1,244 @@
 #include "mm.h"
+#include "mailbox.h"
 #include "string.h"
+#include "spinlock.h"
 
 extern uint64_t __heap_start;
 extern uint64_t __heap_end;
 
-static uint8_t page_map[MAX_PAGES];
+static uint8_t *page_map;
+static uint8_t *page_order;
 static uint64_t heap_start;
 static uint64_t heap_end;
 static uint32_t total_pages;
 
+typedef struct free_page {
+    struct free_page *next;
+    struct free_page *prev;
+} free_page_t;
+
+#define PAGE_ORDER_NONE 0xFF
+
+static free_page_t *free_area[PAGE_MAX_ORDER + 1];
+static uint32_t free_count[PAGE_MAX_ORDER + 1];
+static uint32_t pages_free = 0;
+static uint64_t pool_base = 0;
+static uint64_t pool_end = 0;
+static spinlock_t page_lock;
+
 typedef struct block_header {
     uint32_t size;
     uint32_t magic;
-    bool free;
-    struct block_header *next;
+    uint32_t flags;
+    uint32_t reserved;
 } block_header_t;
 
-#define BLOCK_MAGIC 0x4C415245
+typedef struct free_block {
+    block_header_t header;
+    struct free_block *next;
+    struct free_block *prev;
+} free_block_t;
+
+#define BLOCK_MAGIC     0x4C415245
+#define BLOCK_FREE      (1 << 0)
+#define BLOCK_PREV_FREE (1 << 1)
+#define BLOCK_MIN_SIZE  32
+#define HEAP_BINS       20
+
+typedef struct slab {
+    uint32_t magic;
+    uint32_t inuse;
+    kmem_cache_t *cache;
+    void *free;
+    struct slab *next;
+    struct slab *prev;
+} slab_t;
+
+struct kmem_cache {
+    const char *name;
+    uint32_t obj_size;
+    uint32_t objs_per_slab;
+    uint32_t obj_offset;
+    slab_t *partial;
+    slab_t *full;
+    uint32_t empty_slabs;
+    uint32_t total_slabs;
+    spinlock_t lock;
+};
 
-static block_header_t *free_list = NULL;
+#define SLAB_MAGIC      0x534C4142
+#define SLAB_BYTES      (PAGE_SIZE * SLAB_PAGES)
+#define MAX_CACHES      32
+#define SIZE_CLASSES    8
+
+static kmem_cache_t caches[MAX_CACHES];
+static uint32_t cache_count = 0;
+static spinlock_t cache_list_lock;
+static kmem_cache_t *size_caches[SIZE_CLASSES];
+static const char *size_cache_names[SIZE_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+static free_block_t *heap_bins[HEAP_BINS];
+static uint32_t heap_bin_map = 0;
 static uint64_t kmalloc_base = 0;
 static uint64_t kmalloc_end = 0;
+static spinlock_t heap_lock;
+
+static volatile uint64_t heap_used = 0;
+static volatile uint64_t slab_used = 0;
+static volatile uint64_t alloc_count = 0;
+static volatile uint64_t release_count = 0;
+
+static inline uint32_t page_index(uint64_t addr) {
+    return (addr - heap_start) / PAGE_SIZE;
+}
+
+static void free_area_push(uint64_t addr, uint32_t order) {
+    free_page_t *page = (free_page_t*)addr;
+    page->prev = NULL;
+    page->next = free_area[order];
+    if (page->next) page->next->prev = page;
+    free_area[order] = page;
+    free_count[order]++;
+    pages_free += 1U << order;
+
+    uint32_t idx = page_index(addr);
+    page_map[idx] = MEM_FREE;
+    page_order[idx] = order;
+}
+
+static void free_area_remove(uint64_t addr, uint32_t order) {
+    free_page_t *page = (free_page_t*)addr;
+    if (page->prev) page->prev->next = page->next;
+    else free_area[order] = page->next;
+    if (page->next) page->next->prev = page->prev;
+    free_count[order]--;
+    pages_free -= 1U << order;
+
+    page_order[page_index(addr)] = PAGE_ORDER_NONE;
+}
+
+static inline slab_t *slab_of(void *ptr) {
+    return (slab_t*)((uint64_t)ptr & ~((uint64_t)SLAB_BYTES - 1));
+}
+
+static void slab_list_remove(slab_t **list, slab_t *slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *list = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+}
+
+static void slab_list_push(slab_t **list, slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (slab->next) slab->next->prev = slab;
+    *list = slab;
+}
+
+static inline uint32_t heap_bin(uint32_t size) {
+    uint32_t bin = 31 - __builtin_clz(size) - 5;
+    return bin < HEAP_BINS ? bin : HEAP_BINS - 1;
+}
+
+static inline block_header_t *block_next(block_header_t *block) {
+    return (block_header_t*)((uint8_t*)block + sizeof(block_header_t) + block->size);
+}
+
+static inline block_header_t *block_prev(block_header_t *block) {
+    uint64_t prev_size = *((uint64_t*)block - 1);
+    return (block_header_t*)((uint8_t*)block - prev_size - sizeof(block_header_t));
+}
+
+static inline void block_set_footer(block_header_t *block) {
+    *((uint64_t*)block_next(block) - 1) = block->size;
+}
+
+static void block_mark_next(block_header_t *block, bool prev_free) {
+    block_header_t *next = block_next(block);
+    if ((uint64_t)next >= kmalloc_end) return;
+    if (prev_free) next->flags |= BLOCK_PREV_FREE;
+    else next->flags &= ~BLOCK_PREV_FREE;
+}
+
+static void bin_insert(block_header_t *block);
+static void bin_remove(block_header_t *block);
+
+static void block_trim(block_header_t *block, uint32_t size) {
+    if (block->size < size + sizeof(block_header_t) + BLOCK_MIN_SIZE) {
+        block_mark_next(block, false);
+        return;
+    }
+
+    block_header_t *rest = (block_header_t*)((uint8_t*)block + sizeof(block_header_t) + size);
+    rest->size = block->size - size - sizeof(block_header_t);
+    rest->magic = BLOCK_MAGIC;
+    rest->flags = BLOCK_FREE;
+    block->size = size;
+
+    block_header_t *next = block_next(rest);
+    if ((uint64_t)next < kmalloc_end && (next->flags & BLOCK_FREE)) {
+        bin_remove(next);
+        rest->size += sizeof(block_header_t) + next->size;
+        next->magic = 0;
+    }
+
+    block_set_footer(rest);
+    block_mark_next(rest, true);
+    bin_insert(rest);
+}
+
+/* The catch-all top bin is kept largest first so mm_get_info() can read
+   its head. It only holds blocks of 16 MB and up, so the walk is short. */
+static void bin_insert(block_header_t *block) {
+    free_block_t *fb = (free_block_t*)block;
+    uint32_t bin = heap_bin(block->size);
+    free_block_t *prev = NULL;
+    free_block_t *next = heap_bins[bin];
+    if (bin == HEAP_BINS - 1) {
+        while (next && next->header.size > block->size) {
+            prev = next;
+            next = next->next;
+        }
+    }
+    fb->prev = prev;
+    fb->next = next;
+    if (next) next->prev = fb;
+    if (prev) prev->next = fb;
+    else heap_bins[bin] = fb;
+    heap_bin_map |= 1U << bin;
+}
+
+static void bin_remove(block_header_t *block) {
+    free_block_t *fb = (free_block_t*)block;
+    uint32_t bin = heap_bin(block->size);
+    if (fb->prev) fb->prev->next = fb->next;
+    else heap_bins[bin] = fb->next;
+    if (fb->next) fb->next->prev = fb->prev;
+    if (!heap_bins[bin]) heap_bin_map &= ~(1U << bin);
+}
 
 void mm_init(void) {
-    heap_start = (uint64_t)&__heap_start;
-    heap_end = (uint64_t)&__heap_end;
+    spin_lock_init(&page_lock, "mm_page");
+    spin_lock_init(&heap_lock, "mm_heap");
+    spin_lock_init(&cache_list_lock, "mm_caches");
+
+    heap_start = ALIGN((uint64_t)&__heap_start, PAGE_SIZE);
+    heap_end = mailbox_get_arm_memory();
+    if (heap_end == 0) heap_end = (uint64_t)&__heap_end;
+    if (heap_end > MMIO_BASE) heap_end = MMIO_BASE;
+    heap_end &= ~((uint64_t)PAGE_SIZE - 1);
+
+    uint64_t meta_bytes = ALIGN(((heap_end - heap_start) / PAGE_SIZE) * 2, PAGE_SIZE);
+    page_map = (uint8_t*)heap_start;
+    page_order = page_map + meta_bytes / 2;
+    heap_start += meta_bytes;
 
     total_pages = (heap_end - heap_start) / PAGE_SIZE;
-    if (total_pages > MAX_PAGES) total_pages = MAX_PAGES;
 
     memset(page_map, MEM_FREE, total_pages);
+    memset(page_order, PAGE_ORDER_NONE, total_pages);
 
     uint32_t kmalloc_pages = total_pages / 4;
     for (uint32_t i = 0; i < kmalloc_pages; i++) {
@@ -37,106 +246,644 @@ void mm_init(void) {
     }
 
     kmalloc_base = heap_start;
-    kmalloc_end = heap_start + kmalloc_pages * PAGE_SIZE;
+    kmalloc_end = heap_start + (uint64_t)kmalloc_pages * PAGE_SIZE;
+
+    memset(heap_bins, 0, sizeof(heap_bins));
+    heap_bin_map = 0;
+
+    block_header_t *first = (block_header_t*)kmalloc_base;
+    first->size = kmalloc_end - kmalloc_base - sizeof(block_header_t);
+    first->magic = BLOCK_MAGIC;
+    first->flags = BLOCK_FREE;
+    block_set_footer(first);
+    bin_insert(first);
+
+    pool_base = kmalloc_end;
+    pool_end = heap_start + (uint64_t)total_pages * PAGE_SIZE;
+    memset(free_area, 0, sizeof(free_area));
+    memset(free_count, 0, sizeof(free_count));
+    pages_free = 0;
+    heap_used = 0;
+    slab_used = 0;
+    alloc_count = 0;
+    release_count = 0;
 
-    free_list = (block_header_t*)kmalloc_base;
-    free_list->size = kmalloc_end - kmalloc_base - sizeof(block_header_t);
-    free_list->magic = BLOCK_MAGIC;
-    free_list->free = true;
-    free_list->next = NULL;
+    uint64_t addr = pool_base;
+    while (addr < pool_end) {
+        uint32_t order = PAGE_MAX_ORDER;
+        while (order > 0 && ((addr & ((PAGE_SIZE << order) - 1)) ||
+                             addr + ((uint64_t)PAGE_SIZE << order) > pool_end)) {
+            order--;
+        }
+        free_area_push(addr, order);
+        addr += (uint64_t)PAGE_SIZE << order;
+    }
+
+    cache_count = 0;
+    for (uint32_t i = 0; i < SIZE_CLASSES; i++) {
+        size_caches[i] = kmem_cache_create(size_cache_names[i], SLAB_MIN_SIZE << i);
+    }
 }
 
-void *kmalloc(size_t size) {
+static void *heap_alloc(size_t size) {
     size = ALIGN(size, 16);
-    block_header_t *curr = free_list;
-
-    while (curr) {
-        if (curr->free && curr->size >= size) {
-            if (curr->size > size + sizeof(block_header_t) + 16) {
-                block_header_t *new_block = (block_header_t*)((uint8_t*)curr + sizeof(block_header_t) + size);
-                new_block->size = curr->size - size - sizeof(block_header_t);
-                new_block->magic = BLOCK_MAGIC;
-                new_block->free = true;
-                new_block->next = curr->next;
-                curr->next = new_block;
-                curr->size = size;
+    if (size < BLOCK_MIN_SIZE) size = BLOCK_MIN_SIZE;
+    if (size >= kmalloc_end - kmalloc_base) return NULL;
+
+    uint32_t bin = heap_bin(size);
+    free_block_t *fit = heap_bins[bin];
+    while (fit && fit->header.size < size) fit = fit->next;
+
+    if (!fit) {
+        uint32_t larger = heap_bin_map & ~((2U << bin) - 1);
+        if (!larger) return NULL;
+        fit = heap_bins[__builtin_ctz(larger)];
+    }
+
+    block_header_t *block = &fit->header;
+    bin_remove(block);
+    block_trim(block, size);
+
+    block->flags &= ~BLOCK_FREE;
+    atomic_add64(&heap_used, block->size);
+    atomic_add64(&alloc_count, 1);
+    return (void*)(block + 1);
+}
+
+static void *kmalloc_raw(size_t size) {
+    if (size <= SLAB_MAX_SIZE) {
+        uint32_t cls = 0;
+        while ((size_t)(SLAB_MIN_SIZE << cls) < size) cls++;
+        void *ptr = kmem_cache_alloc(size_caches[cls]);
+        if (ptr) return ptr;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    void *ptr = heap_alloc(size);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return ptr;
+}
+
+static void heap_free(void *ptr) {
+    block_header_t *block = (block_header_t*)ptr - 1;
+    if (block->magic != BLOCK_MAGIC || (block->flags & BLOCK_FREE)) return;
+
+    atomic_add64(&heap_used, -(uint64_t)block->size);
+    atomic_add64(&release_count, 1);
+
+    block_header_t *next = block_next(block);
+    if ((uint64_t)next < kmalloc_end && (next->flags & BLOCK_FREE)) {
+        bin_remove(next);
+        block->size += sizeof(block_header_t) + next->size;
+        next->magic = 0;
+    }
+
+    if (block->flags & BLOCK_PREV_FREE) {
+        block_header_t *prev = block_prev(block);
+        bin_remove(prev);
+        prev->size += sizeof(block_header_t) + block->size;
+        block->magic = 0;
+        block = prev;
+    }
+
+    block->flags = BLOCK_FREE;
+    block_set_footer(block);
+    block_mark_next(block, true);
+    bin_insert(block);
+}
+
+static void kfree_raw(void *ptr) {
+    uint64_t addr = (uint64_t)ptr;
+    if (addr >= kmalloc_base && addr < kmalloc_end) {
+        uint64_t flags = spin_lock_irqsave(&heap_lock);
+        heap_free(ptr);
+        spin_unlock_irqrestore(&heap_lock, flags);
+    } else if (addr >= pool_base && addr < pool_end) {
+        slab_t *slab = slab_of(ptr);
+        if (slab->magic == SLAB_MAGIC) kmem_cache_free(slab->cache, ptr);
+    }
+}
+
+static void *heap_realloc(void *ptr, size_t new_size) {
+    block_header_t *block = (block_header_t*)ptr - 1;
+    if (block->magic != BLOCK_MAGIC || (block->flags & BLOCK_FREE)) return NULL;
+
+    size_t size = ALIGN(new_size, 16);
+    if (size < BLOCK_MIN_SIZE) size = BLOCK_MIN_SIZE;
+    if (size >= kmalloc_end - kmalloc_base) return NULL;
+
+    uint32_t old_size = block->size;
+
+    if (size <= block->size) {
+        block_trim(block, size);
+        atomic_add64(&heap_used, -(uint64_t)(old_size - block->size));
+        return ptr;
+    }
+
+    uint64_t avail = block->size;
+    block_header_t *next = block_next(block);
+    bool next_free = (uint64_t)next < kmalloc_end && (next->flags & BLOCK_FREE);
+    if (next_free) avail += sizeof(block_header_t) + next->size;
+
+    if (avail >= size) {
+        bin_remove(next);
+        block->size = avail;
+        next->magic = 0;
+        block_trim(block, size);
+        atomic_add64(&heap_used, block->size - old_size);
+        return ptr;
+    }
+
+    if (block->flags & BLOCK_PREV_FREE) {
+        block_header_t *prev = block_prev(block);
+        if (avail + sizeof(block_header_t) + prev->size >= size) {
+            if (next_free) {
+                bin_remove(next);
+                next->magic = 0;
             }
-            curr->free = false;
-            return (void*)((uint8_t*)curr + sizeof(block_header_t));
+            bin_remove(prev);
+            prev->size += sizeof(block_header_t) + avail;
+            prev->flags &= ~BLOCK_FREE;
+            block->magic = 0;
+
+            memmove(prev + 1, ptr, old_size);
+            block_trim(prev, size);
+            atomic_add64(&heap_used, prev->size - old_size);
+            return (void*)(prev + 1);
+        }
+    }
+
+    void *new_ptr = heap_alloc(size);
+    if (!new_ptr) return NULL;
+    memcpy(new_ptr, ptr, block->size);
+    heap_free(ptr);
+    return new_ptr;
+}
+
+static size_t ksize_raw(void *ptr) {
+    uint64_t addr = (uint64_t)ptr;
+    if (addr >= kmalloc_base && addr < kmalloc_end) {
+        block_header_t *block = (block_header_t*)ptr - 1;
+        return block->magic == BLOCK_MAGIC ? block->size : 0;
+    } else if (addr >= pool_base && addr < pool_end) {
+        slab_t *slab = slab_of(ptr);
+        return slab->magic == SLAB_MAGIC ? slab->cache->obj_size : 0;
+    }
+    return 0;
+}
+
+static void *krealloc_raw(void *ptr, size_t new_size) {
+    uint64_t addr = (uint64_t)ptr;
+    if (addr >= kmalloc_base && addr < kmalloc_end) {
+        if (new_size > SLAB_MAX_SIZE) {
+            uint64_t flags = spin_lock_irqsave(&heap_lock);
+            void *new_ptr = heap_realloc(ptr, new_size);
+            spin_unlock_irqrestore(&heap_lock, flags);
+            return new_ptr;
+        }
+    } else if (new_size <= ksize_raw(ptr)) {
+        return ptr;
+    }
+
+    size_t old_size = ksize_raw(ptr);
+    void *new_ptr = kmalloc_raw(new_size);
+    if (!new_ptr) return NULL;
+    memcpy(new_ptr, ptr, MIN(old_size, new_size));
+    kfree_raw(ptr);
+    return new_ptr;
+}
+
+#ifdef MM_PROFILE
+typedef struct {
+    uint32_t site;
+    uint32_t magic;
+    uint64_t size;
+} profile_tag_t;
+
+#define PROFILE_MAGIC   0x50524F46
+#define PROFILE_TAG     sizeof(profile_tag_t)
+
+static heap_site_t sites[HEAP_PROFILE_SITES];
+static spinlock_t profile_lock;
+
+static uint32_t profile_site(uint64_t caller) {
+    uint32_t idx = (uint32_t)((caller >> 2) * 0x9E3779B97F4A7C15ULL >> 40) % (HEAP_PROFILE_SITES - 1);
+    for (uint32_t i = 0; i < HEAP_PROFILE_SITES - 1; i++) {
+        heap_site_t *s = &sites[idx];
+        if (s->caller == caller) return idx;
+        if (s->caller == 0) {
+            s->caller = caller;
+            return idx;
         }
-        curr = curr->next;
+        idx = (idx + 1) % (HEAP_PROFILE_SITES - 1);
+    }
+    return HEAP_PROFILE_SITES - 1;
+}
+
+static void profile_account(uint32_t idx, uint64_t size, bool alloc) {
+    heap_site_t *s = &sites[idx];
+    if (alloc) {
+        s->allocs++;
+        s->live_count++;
+        s->live_bytes += size;
+        if (s->live_bytes > s->peak_bytes) s->peak_bytes = s->live_bytes;
+    } else {
+        s->frees++;
+        s->live_count--;
+        s->live_bytes -= size;
     }
-    return NULL;
+}
+
+static void *profile_alloc(size_t size, void *caller) {
+    profile_tag_t *tag = (profile_tag_t*)kmalloc_raw(size + PROFILE_TAG);
+    if (!tag) return NULL;
+
+    uint64_t flags = spin_lock_irqsave(&profile_lock);
+    tag->site = profile_site((uint64_t)caller);
+    tag->magic = PROFILE_MAGIC;
+    tag->size = size;
+    profile_account(tag->site, size, true);
+    spin_unlock_irqrestore(&profile_lock, flags);
+    return (void*)(tag + 1);
+}
+
+static profile_tag_t *profile_tag(void *ptr) {
+    profile_tag_t *tag = (profile_tag_t*)ptr - 1;
+    return tag->magic == PROFILE_MAGIC ? tag : NULL;
+}
+
+int heap_profile_top(heap_site_t *out, int max) {
+    int count = 0;
+    uint64_t flags = spin_lock_irqsave(&profile_lock);
+    for (uint32_t i = 0; i < HEAP_PROFILE_SITES; i++) {
+        if (!sites[i].allocs) continue;
+
+        int pos = count < max ? count++ : max;
+        while (pos > 0 && out[pos - 1].live_bytes < sites[i].live_bytes) {
+            if (pos < max) out[pos] = out[pos - 1];
+            pos--;
+        }
+        if (pos < max) out[pos] = sites[i];
+    }
+    spin_unlock_irqrestore(&profile_lock, flags);
+    return count;
+}
+#else
+int heap_profile_top(heap_site_t *out, int max) {
+    UNUSED(out); UNUSED(max);
+    return -1;
+}
+#endif
+
+void *kmalloc(size_t size) {
+#ifdef MM_PROFILE
+    return profile_alloc(size, __builtin_return_address(0));
+#else
+    return kmalloc_raw(size);
+#endif
 }
 
 void *kcalloc(size_t count, size_t size) {
-    void *ptr = kmalloc(count * size);
+#ifdef MM_PROFILE
+    void *ptr = profile_alloc(count * size, __builtin_return_address(0));
+#else
+    void *ptr = kmalloc_raw(count * size);
+#endif
     if (ptr) memset(ptr, 0, count * size);
     return ptr;
 }
 
 void kfree(void *ptr) {
     if (!ptr) return;
+#ifdef MM_PROFILE
+    profile_tag_t *tag = profile_tag(ptr);
+    if (!tag) return;
+    uint64_t flags = spin_lock_irqsave(&profile_lock);
+    profile_account(tag->site, tag->size, false);
+    tag->magic = 0;
+    spin_unlock_irqrestore(&profile_lock, flags);
+    ptr = tag;
+#endif
+    kfree_raw(ptr);
+}
 
-    block_header_t *block = (block_header_t*)((uint8_t*)ptr - sizeof(block_header_t));
-    if (block->magic != BLOCK_MAGIC) return;
-
-    block->free = true;
+size_t ksize(void *ptr) {
+    if (!ptr) return 0;
+#ifdef MM_PROFILE
+    profile_tag_t *tag = profile_tag(ptr);
+    if (!tag) return 0;
+    return ksize_raw(tag) - PROFILE_TAG;
+#else
+    return ksize_raw(ptr);
+#endif
+}
 
-    block_header_t *curr = free_list;
-    while (curr) {
-        if (curr->free && curr->next && curr->next->free) {
-            curr->size += sizeof(block_header_t) + curr->next->size;
-            curr->next = curr->next->next;
-            continue;
-        }
-        curr = curr->next;
+void *krealloc(void *ptr, size_t new_size) {
+#ifdef MM_PROFILE
+    if (!ptr) return profile_alloc(new_size, __builtin_return_address(0));
+#else
+    if (!ptr) return kmalloc_raw(new_size);
+#endif
+    if (new_size == 0) {
+        kfree(ptr);
+        return NULL;
     }
+
+#ifdef MM_PROFILE
+    profile_tag_t *tag = profile_tag(ptr);
+    if (!tag) return NULL;
+
+    uint64_t old_size = tag->size;
+    tag = (profile_tag_t*)krealloc_raw(tag, new_size + PROFILE_TAG);
+    if (!tag) return NULL;
+
+    uint64_t flags = spin_lock_irqsave(&profile_lock);
+    heap_site_t *s = &sites[tag->site];
+    s->live_bytes = s->live_bytes - old_size + new_size;
+    if (s->live_bytes > s->peak_bytes) s->peak_bytes = s->live_bytes;
+    tag->size = new_size;
+    spin_unlock_irqrestore(&profile_lock, flags);
+    return (void*)(tag + 1);
+#else
+    return krealloc_raw(ptr, new_size);
+#endif
 }
 
 void *page_alloc(uint32_t count) {
-    uint32_t start = total_pages / 4;
-    uint32_t found = 0;
-    uint32_t first = 0;
-
-    for (uint32_t i = start; i < total_pages; i++) {
-        if (page_map[i] == MEM_FREE) {
-            if (found == 0) first = i;
-            found++;
-            if (found == count) {
-                for (uint32_t j = first; j < first + count; j++) {
-                    page_map[j] = MEM_USED;
-                }
-                return (void*)(heap_start + first * PAGE_SIZE);
-            }
+    if (count == 0) return NULL;
+
+    uint32_t order = 0;
+    while ((1U << order) < count) order++;
+    if (order > PAGE_MAX_ORDER) return NULL;
+
+    uint64_t flags = spin_lock_irqsave(&page_lock);
+    uint32_t o = order;
+    while (o <= PAGE_MAX_ORDER && !free_area[o]) o++;
+    if (o > PAGE_MAX_ORDER) {
+        spin_unlock_irqrestore(&page_lock, flags);
+        return NULL;
+    }
+
+    uint64_t addr = (uint64_t)free_area[o];
+    free_area_remove(addr, o);
+
+    while (o > order) {
+        o--;
+        free_area_push(addr + ((uint64_t)PAGE_SIZE << o), o);
+    }
+
+    uint32_t idx = page_index(addr);
+    page_map[idx] = MEM_USED;
+    page_order[idx] = order;
+    spin_unlock_irqrestore(&page_lock, flags);
+    return (void*)addr;
+}
+
+void page_free(void *ptr) {
+    uint64_t addr = (uint64_t)ptr;
+    if (!ptr || addr < pool_base || addr >= pool_end || (addr & (PAGE_SIZE - 1))) return;
+
+    uint32_t idx = page_index(addr);
+    uint64_t flags = spin_lock_irqsave(&page_lock);
+    if (page_map[idx] != MEM_USED || page_order[idx] == PAGE_ORDER_NONE) {
+        spin_unlock_irqrestore(&page_lock, flags);
+        return;
+    }
+
+    uint32_t order = page_order[idx];
+    page_map[idx] = MEM_FREE;
+    page_order[idx] = PAGE_ORDER_NONE;
+
+    while (order < PAGE_MAX_ORDER) {
+        uint64_t buddy = addr ^ ((uint64_t)PAGE_SIZE << order);
+        if (buddy < pool_base || buddy >= pool_end) break;
+
+        uint32_t bidx = page_index(buddy);
+        if (page_map[bidx] != MEM_FREE || page_order[bidx] != order) break;
+
+        free_area_remove(buddy, order);
+        if (buddy < addr) addr = buddy;
+        order++;
+    }
+
+    free_area_push(addr, order);
+    spin_unlock_irqrestore(&page_lock, flags);
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size) {
+    if (size == 0 || size > SLAB_MAX_SIZE) return NULL;
+
+    uint64_t flags = spin_lock_irqsave(&cache_list_lock);
+    if (cache_count >= MAX_CACHES) {
+        spin_unlock_irqrestore(&cache_list_lock, flags);
+        return NULL;
+    }
+    kmem_cache_t *cache = &caches[cache_count++];
+    spin_unlock_irqrestore(&cache_list_lock, flags);
+
+    memset(cache, 0, sizeof(kmem_cache_t));
+    spin_lock_init(&cache->lock, name);
+
+    cache->name = name;
+    cache->obj_size = ALIGN(size, 16);
+    cache->obj_offset = ALIGN(sizeof(slab_t), 64);
+    cache->objs_per_slab = (SLAB_BYTES - cache->obj_offset) / cache->obj_size;
+    return cache;
+}
+
+static slab_t *slab_grow(kmem_cache_t *cache) {
+    slab_t *slab = (slab_t*)page_alloc(SLAB_PAGES);
+    if (!slab) return NULL;
+
+    slab->magic = SLAB_MAGIC;
+    slab->inuse = 0;
+    slab->cache = cache;
+    slab->free = NULL;
+
+    uint8_t *base = (uint8_t*)slab + cache->obj_offset;
+    for (uint32_t i = cache->objs_per_slab; i > 0; i--) {
+        void *obj = base + (i - 1) * cache->obj_size;
+        *(void**)obj = slab->free;
+        slab->free = obj;
+    }
+
+    slab_list_push(&cache->partial, slab);
+    cache->empty_slabs++;
+    cache->total_slabs++;
+    return slab;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    if (!cache) return NULL;
+
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    slab_t *slab = cache->partial;
+    if (!slab) slab = slab_grow(cache);
+    if (!slab) {
+        spin_unlock_irqrestore(&cache->lock, flags);
+        return NULL;
+    }
+
+    void *obj = slab->free;
+    slab->free = *(void**)obj;
+    if (slab->inuse++ == 0) cache->empty_slabs--;
+
+    if (!slab->free) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+
+    atomic_add64(&slab_used, cache->obj_size);
+    atomic_add64(&alloc_count, 1);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *ptr) {
+    if (!cache || !ptr) return;
+
+    slab_t *slab = slab_of(ptr);
+    if (slab->magic != SLAB_MAGIC || slab->cache != cache) return;
+
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    if (!slab->free) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+
+    *(void**)ptr = slab->free;
+    slab->free = ptr;
+
+    if (--slab->inuse == 0) {
+        if (cache->empty_slabs > 0) {
+            slab_list_remove(&cache->partial, slab);
+            slab->magic = 0;
+            cache->total_slabs--;
+            page_free(slab);
         } else {
-            found = 0;
+            cache->empty_slabs++;
         }
     }
-    return NULL;
+    spin_unlock_irqrestore(&cache->lock, flags);
+
+    atomic_add64(&slab_used, -(uint64_t)cache->obj_size);
+    atomic_add64(&release_count, 1);
 }
 
-void page_free(void *ptr, uint32_t count) {
-    uint64_t addr = (uint64_t)ptr;
-    uint32_t first = (addr - heap_start) / PAGE_SIZE;
+static arena_chunk_t *arena_chunk_alloc(uint32_t pages) {
+    uint32_t order = 0;
+    while ((1U << order) < pages) order++;
+    pages = 1U << order;
+
+    arena_chunk_t *chunk = (arena_chunk_t*)page_alloc(pages);
+    if (!chunk) return NULL;
+    chunk->next = NULL;
+    chunk->pages = pages;
+    return chunk;
+}
+
+static inline uint64_t arena_chunk_data(arena_chunk_t *chunk) {
+    return (uint64_t)chunk + ALIGN(sizeof(arena_chunk_t), 16);
+}
 
-    for (uint32_t i = first; i < first + count && i < total_pages; i++) {
-        page_map[i] = MEM_FREE;
+static inline uint64_t arena_chunk_end(arena_chunk_t *chunk) {
+    return (uint64_t)chunk + (uint64_t)chunk->pages * PAGE_SIZE;
+}
+
+arena_t *arena_create(size_t chunk_size) {
+    uint32_t pages = ALIGN(chunk_size, PAGE_SIZE) / PAGE_SIZE;
+    if (pages < ARENA_CHUNK_PAGES) pages = ARENA_CHUNK_PAGES;
+
+    arena_chunk_t *chunk = arena_chunk_alloc(pages);
+    if (!chunk) return NULL;
+
+    arena_t *arena = (arena_t*)arena_chunk_data(chunk);
+    arena->head = chunk;
+    arena->current = chunk;
+    arena->chunk_pages = chunk->pages;
+    arena->ptr = ALIGN((uint64_t)(arena + 1), 16);
+    arena->end = arena_chunk_end(chunk);
+    return arena;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    if (!arena || size == 0) return NULL;
+
+    size = ALIGN(size, 16);
+    if (arena->ptr + size > arena->end) {
+        uint32_t pages = ALIGN(size + ALIGN(sizeof(arena_chunk_t), 16), PAGE_SIZE) / PAGE_SIZE;
+        if (pages < arena->chunk_pages) pages = arena->chunk_pages;
+
+        arena_chunk_t *chunk = arena_chunk_alloc(pages);
+        if (!chunk) return NULL;
+
+        arena->current->next = chunk;
+        arena->current = chunk;
+        arena->ptr = arena_chunk_data(chunk);
+        arena->end = arena_chunk_end(chunk);
+    }
+
+    void *ptr = (void*)arena->ptr;
+    arena->ptr += size;
+    return ptr;
+}
+
+void arena_reset(arena_t *arena) {
+    if (!arena) return;
+
+    arena_chunk_t *chunk = arena->head->next;
+    while (chunk) {
+        arena_chunk_t *next = chunk->next;
+        page_free(chunk);
+        chunk = next;
     }
+
+    arena->head->next = NULL;
+    arena->current = arena->head;
+    arena->ptr = ALIGN((uint64_t)(arena + 1), 16);
+    arena->end = arena_chunk_end(arena->head);
+}
+
+void arena_destroy(arena_t *arena) {
+    if (!arena) return;
+    arena_reset(arena);
+    page_free(arena->head);
 }
 
 mem_info_t mm_get_info(void) {
     mem_info_t info;
+    uint64_t flags = spin_lock_irqsave(&page_lock);
     info.pages_total = total_pages;
-    info.pages_used = 0;
-
-    for (uint32_t i = 0; i < total_pages; i++) {
-        if (page_map[i] != MEM_FREE) info.pages_used++;
-    }
+    info.pages_used = total_pages - pages_free;
+    memcpy(info.free_blocks, free_count, sizeof(info.free_blocks));
+    spin_unlock_irqrestore(&page_lock, flags);
 
     info.total = (uint64_t)total_pages * PAGE_SIZE;
     info.used = (uint64_t)info.pages_used * PAGE_SIZE;
     info.free = info.total - info.used;
 
+    info.heap_total = kmalloc_end - kmalloc_base;
+    info.heap_used = heap_used;
+    info.slab_used = slab_used;
+    info.alloc_count = alloc_count;
+    info.free_count = release_count;
+
+    info.largest_free = 0;
+    for (int o = PAGE_MAX_ORDER; o >= 0; o--) {
+        if (free_count[o]) {
+            info.largest_free = (uint64_t)PAGE_SIZE << o;
+            break;
+        }
+    }
+    /* Below the sorted top bin a block is only known by its size class,
+       so the figure there is a lower bound within a factor of two. */
+    flags = spin_lock_irqsave(&heap_lock);
+    if (heap_bin_map) {
+        uint32_t bin = 31 - __builtin_clz(heap_bin_map);
+        uint64_t size = bin == HEAP_BINS - 1 ? heap_bins[bin]->header.size : 1ULL << (bin + 5);
+        if (size > info.largest_free) info.largest_free = size;
+    }
+    spin_unlock_irqrestore(&heap_lock, flags);
+
     return info;
 }
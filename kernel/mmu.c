@@ -0,0 +1,145 @@
+#include "mmu.h"
+
+#define PT_ENTRIES      512
+#define PT_VALID        (1ULL << 0)
+#define PT_TABLE        (1ULL << 1)
+#define PT_BLOCK        (0ULL << 1)
+#define PT_ATTR(idx)    ((uint64_t)(idx) << 2)
+#define PT_SH_OUTER     (2ULL << 8)
+#define PT_SH_INNER     (3ULL << 8)
+#define PT_AF           (1ULL << 10)
+#define PT_PXN          (1ULL << 53)
+#define PT_UXN          (1ULL << 54)
+
+#define L1_SHIFT        30
+#define L2_SHIFT        21
+#define L1_ENTRIES      (MMU_VA_LIMIT >> L1_SHIFT)
+
+#define MAIR_VALUE      ((0x00ULL << (8 * MT_DEVICE_nGnRnE)) | \
+                         (0x04ULL << (8 * MT_DEVICE_nGnRE))  | \
+                         (0x44ULL << (8 * MT_NORMAL_NC))     | \
+                         (0xFFULL << (8 * MT_NORMAL)))
+
+#define TCR_T0SZ        (64 - 32)
+#define TCR_IRGN0_WBWA  (1ULL << 8)
+#define TCR_ORGN0_WBWA  (1ULL << 10)
+#define TCR_SH0_INNER   (3ULL << 12)
+#define TCR_TG0_4K      (0ULL << 14)
+#define TCR_EPD1        (1ULL << 23)
+#define TCR_IPS_4G      (0ULL << 32)
+#define TCR_VALUE       (TCR_T0SZ | TCR_IRGN0_WBWA | TCR_ORGN0_WBWA | TCR_SH0_INNER | \
+                         TCR_TG0_4K | TCR_EPD1 | TCR_IPS_4G)
+
+#define SCTLR_M         (1ULL << 0)
+#define SCTLR_C         (1ULL << 2)
+#define SCTLR_I         (1ULL << 12)
+
+static uint64_t l1_table[PT_ENTRIES] __attribute__((aligned(4096)));
+static uint64_t l2_tables[L1_ENTRIES][PT_ENTRIES] __attribute__((aligned(4096)));
+static volatile bool enabled = false;
+
+static uint64_t block_desc(uint64_t addr, uint32_t attr) {
+    uint64_t desc = addr | PT_BLOCK | PT_VALID | PT_AF | PT_ATTR(attr);
+
+    if (attr == MT_NORMAL) {
+        desc |= PT_SH_INNER;
+    } else if (attr == MT_NORMAL_NC) {
+        desc |= PT_SH_OUTER;
+    } else {
+        desc |= PT_PXN | PT_UXN;
+    }
+    return desc;
+}
+
+static uint32_t dcache_line_size(void) {
+    uint64_t ctr;
+    asm volatile("mrs %0, ctr_el0" : "=r"(ctr));
+    return 4 << ((ctr >> 16) & 0xF);
+}
+
+void dcache_clean_range(uint64_t start, uint64_t size) {
+    uint64_t line = dcache_line_size();
+    uint64_t end = start + size;
+    for (uint64_t p = start & ~(line - 1); p < end; p += line) {
+        asm volatile("dc cvac, %0" :: "r"(p) : "memory");
+    }
+    asm volatile("dsb sy" ::: "memory");
+}
+
+void dcache_invalidate_range(uint64_t start, uint64_t size) {
+    uint64_t line = dcache_line_size();
+    uint64_t end = start + size;
+    for (uint64_t p = start & ~(line - 1); p < end; p += line) {
+        asm volatile("dc ivac, %0" :: "r"(p) : "memory");
+    }
+    asm volatile("dsb sy" ::: "memory");
+}
+
+void dcache_clean_invalidate_range(uint64_t start, uint64_t size) {
+    uint64_t line = dcache_line_size();
+    uint64_t end = start + size;
+    for (uint64_t p = start & ~(line - 1); p < end; p += line) {
+        asm volatile("dc civac, %0" :: "r"(p) : "memory");
+    }
+    asm volatile("dsb sy" ::: "memory");
+}
+
+void mmu_map_range(uint64_t base, uint64_t size, uint32_t attr) {
+    uint64_t start = base & ~((uint64_t)MMU_BLOCK_SIZE - 1);
+    uint64_t end = ALIGN(base + size, (uint64_t)MMU_BLOCK_SIZE);
+    if (end > MMU_VA_LIMIT) end = MMU_VA_LIMIT;
+
+    if (enabled && attr != MT_NORMAL) {
+        dcache_clean_invalidate_range(start, end - start);
+    }
+
+    for (uint64_t addr = start; addr < end; addr += MMU_BLOCK_SIZE) {
+        uint64_t *entry = &l2_tables[addr >> L1_SHIFT][(addr >> L2_SHIFT) & (PT_ENTRIES - 1)];
+
+        if (enabled) {
+            *entry = 0;
+            asm volatile("dsb ishst" ::: "memory");
+            asm volatile("tlbi vaae1is, %0" :: "r"(addr >> 12) : "memory");
+            asm volatile("dsb ish" ::: "memory");
+        }
+        *entry = block_desc(addr, attr);
+    }
+
+    asm volatile("dsb ishst" ::: "memory");
+    asm volatile("isb" ::: "memory");
+}
+
+void mmu_enable(void) {
+    asm volatile("msr mair_el1, %0" :: "r"(MAIR_VALUE));
+    asm volatile("msr tcr_el1, %0" :: "r"(TCR_VALUE));
+    asm volatile("msr ttbr0_el1, %0" :: "r"((uint64_t)l1_table));
+    asm volatile("isb" ::: "memory");
+
+    asm volatile("ic iallu" ::: "memory");
+    asm volatile("tlbi vmalle1" ::: "memory");
+    asm volatile("dsb ish" ::: "memory");
+    asm volatile("isb" ::: "memory");
+
+    uint64_t sctlr;
+    asm volatile("mrs %0, sctlr_el1" : "=r"(sctlr));
+    sctlr |= SCTLR_M | SCTLR_C | SCTLR_I;
+    asm volatile("msr sctlr_el1, %0" :: "r"(sctlr) : "memory");
+    asm volatile("isb" ::: "memory");
+
+    enabled = true;
+}
+
+bool mmu_is_enabled(void) {
+    return enabled;
+}
+
+void mmu_init(void) {
+    for (uint64_t i = 0; i < L1_ENTRIES; i++) {
+        l1_table[i] = (uint64_t)l2_tables[i] | PT_TABLE | PT_VALID;
+    }
+
+    mmu_map_range(0, MMIO_BASE, MT_NORMAL);
+    mmu_map_range(MMIO_BASE, MMU_VA_LIMIT - MMIO_BASE, MT_DEVICE_nGnRE);
+
+    mmu_enable();
+}
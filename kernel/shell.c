@@ -6,14 +6,29 @@
 #include "power.h"
 #include "fb.h"
 #include "mailbox.h"
+#include "smp.h"
+#include "task.h"
+#include "spinlock.h"
+#include "sync.h"
+#include "atomic.h"
+#include "coroutine.h"
 
 #define MAX_COMMANDS 32
+#define BENCH_SPAWN_COUNT 1000
+#define BENCH_PINGPONG_ROUNDS 10000
+#define BENCH_CORO_COUNT 4096
+#define BENCH_CORO_ROUNDS 8
 
 static shell_command_t commands[MAX_COMMANDS];
 static int command_count = 0;
 static char history[SHELL_HISTORY_SIZE][SHELL_MAX_CMD_LEN];
 static int history_count = 0;
 static int history_pos = 0;
+static arena_t *shell_arena = NULL;
+
+/* Posted once per finished benchmark child. Each phase waits for every
+   post it causes, so the count is back at zero when the next one starts. */
+static semaphore_t bench_done;
 
 static void cmd_help(int argc, char **argv);
 static void cmd_clear(int argc, char **argv);
@@ -31,6 +46,10 @@ static void cmd_echo(int argc, char **argv);
 static void cmd_history(int argc, char **argv);
 static void cmd_color(int argc, char **argv);
 static void cmd_peekpoke(int argc, char **argv);
+static void cmd_heapstat(int argc, char **argv);
+static void cmd_locks(int argc, char **argv);
+static void cmd_ps(int argc, char **argv);
+static void cmd_top(int argc, char **argv);
 
 static void print_banner(void) {
     uart_puts("\n\033[36m");
@@ -73,6 +92,8 @@ void shell_init(void) {
     command_count = 0;
     history_count = 0;
     history_pos = 0;
+    if (!shell_arena) shell_arena = arena_create(PAGE_SIZE * ARENA_CHUNK_PAGES);
+    sem_init(&bench_done, "bench", 0);
 
     shell_register_command("help",      "Show available commands",     cmd_help);
     shell_register_command("clear",     "Clear screen",                cmd_clear);
@@ -88,6 +109,10 @@ void shell_init(void) {
     shell_register_command("history",   "Show command history",        cmd_history);
     shell_register_command("color",     "Test color output",           cmd_color);
     shell_register_command("peek",      "Read memory address",         cmd_peekpoke);
+    shell_register_command("heapstat",  "Show top heap consumers",     cmd_heapstat);
+    shell_register_command("locks",     "Show lock contention",        cmd_locks);
+    shell_register_command("ps",        "List tasks and CPU time",     cmd_ps);
+    shell_register_command("top",       "Show busiest tasks",          cmd_top);
     shell_register_command("reboot",    "Reboot system",               cmd_reboot);
     shell_register_command("shutdown",  "Shutdown system",             cmd_shutdown);
 }
@@ -142,27 +167,46 @@ void shell_run(void) {
             strcpy(history[SHELL_HISTORY_SIZE - 1], cmd);
         }
 
-        char *argv[SHELL_MAX_ARGS];
-        int argc = parse_args(cmd, argv);
-        if (argc == 0) continue;
+        char *line = (char *)arena_alloc(shell_arena, pos + 1);
+        char **argv = (char **)arena_alloc(shell_arena, sizeof(char *) * SHELL_MAX_ARGS);
+        if (!line || !argv) {
+            uart_puts("\033[31mOut of memory\033[0m\n");
+            arena_reset(shell_arena);
+            continue;
+        }
+        memcpy(line, cmd, pos + 1);
+
+        int argc = parse_args(line, argv);
+        if (argc > 0) {
+            bool found = false;
+            for (int i = 0; i < command_count; i++) {
+                if (strcmp(argv[0], commands[i].name) == 0) {
+                    commands[i].handler(argc, argv);
+                    found = true;
+                    break;
+                }
+            }
 
-        bool found = false;
-        for (int i = 0; i < command_count; i++) {
-            if (strcmp(argv[0], commands[i].name) == 0) {
-                commands[i].handler(argc, argv);
-                found = true;
-                break;
+            if (!found) {
+                uart_puts("\033[31mUnknown command: \033[0m");
+                uart_puts(argv[0]);
+                uart_puts("\n");
             }
         }
 
-        if (!found) {
-            uart_puts("\033[31mUnknown command: \033[0m");
-            uart_puts(argv[0]);
-            uart_puts("\n");
-        }
+        arena_reset(shell_arena);
     }
 }
 
+void shell_task(void *arg) {
+    UNUSED(arg);
+    shell_run();
+}
+
+arena_t *shell_get_arena(void) {
+    return shell_arena;
+}
+
 static void cmd_help(int argc, char **argv) {
     UNUSED(argc); UNUSED(argv);
     uart_puts("\033[1mLareOS Commands:\033[0m\n\n");
@@ -227,6 +271,33 @@ static void cmd_info(int argc, char **argv) {
     uart_putuint(get_el());
     uart_putc('\n');
 
+    uart_puts("  Cores:      ");
+    uart_putuint(smp_online_count());
+    uart_puts("/");
+    uart_putuint(NR_CPUS);
+    uart_puts(" online\n");
+
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        percpu_t *pc = smp_get_cpu(cpu);
+        uart_puts("    CPU");
+        uart_putuint(cpu);
+        uart_puts(":     ");
+        uart_puts(smp_state_name(pc->state));
+        if (pc->state == CPU_ONLINE) {
+            uart_puts("  ticks ");
+            uart_putuint(pc->ticks);
+            uart_puts("  irqs ");
+            uart_putuint(pc->irqs);
+            uart_puts("  runq ");
+            uart_putuint(task_get_queue_length(cpu));
+            uart_puts("  steals ");
+            uart_putuint(pc->steals);
+            uart_puts("  ipis ");
+            uart_putuint(pc->ipis);
+        }
+        uart_putc('\n');
+    }
+
     uart_puts("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
 }
 
@@ -288,6 +359,22 @@ static void cmd_mem(int argc, char **argv) {
     uart_puts(" / ");
     uart_putuint(info.pages_total);
     uart_putc('\n');
+    uart_puts("  Heap:       ");
+    uart_putuint(info.heap_used / 1024);
+    uart_puts(" KB / ");
+    uart_putuint(info.heap_total / 1024);
+    uart_puts(" KB\n");
+    uart_puts("  Slab:       ");
+    uart_putuint(info.slab_used / 1024);
+    uart_puts(" KB\n");
+    uart_puts("  Largest:    ");
+    uart_putuint(info.largest_free / 1024);
+    uart_puts(" KB free block\n");
+    uart_puts("  Allocs:     ");
+    uart_putuint(info.alloc_count);
+    uart_puts(" / frees: ");
+    uart_putuint(info.free_count);
+    uart_putc('\n');
 
     uart_puts("  [");
     uint32_t pct = info.pages_used * 100 / info.pages_total;
@@ -298,6 +385,15 @@ static void cmd_mem(int argc, char **argv) {
     uart_puts("] ");
     uart_putuint(pct);
     uart_puts("%%\n");
+
+    uart_puts("  Free blocks by order:\n   ");
+    for (uint32_t o = 0; o <= PAGE_MAX_ORDER; o++) {
+        uart_puts(" ");
+        uart_putuint(o);
+        uart_puts(":");
+        uart_putuint(info.free_blocks[o]);
+    }
+    uart_putc('\n');
 }
 
 static void cmd_temp(int argc, char **argv) {
@@ -363,12 +459,59 @@ static void cmd_profile(int argc, char **argv) {
     }
 }
 
+static void bench_spawn_task(void *arg) {
+    UNUSED(arg);
+    sem_post(&bench_done);
+}
+
+static uint32_t pingpong_cpu;
+static volatile uint32_t pingpong_turn;
+static volatile uint64_t pingpong_switches;
+
+/* Two of these share one core and hand the turn back and forth. */
+static void bench_pingpong_task(void *arg) {
+    uint32_t me = (uint32_t)(uint64_t)arg;
+    task_t *self = task_get_current();
+
+    task_set_affinity(self->id, CPU_MASK(pingpong_cpu));
+    while (smp_cpu_id() != pingpong_cpu) task_yield();
+
+    uint64_t switches = self->nvcsw;
+    for (uint32_t i = 0; i < BENCH_PINGPONG_ROUNDS; i++) {
+        while (pingpong_turn != me) task_yield();
+        pingpong_turn = !me;
+    }
+    atomic_add64(&pingpong_switches, self->nvcsw - switches);
+    sem_post(&bench_done);
+}
+
+typedef struct {
+    coro_t co;
+    uint32_t round;
+} bench_coro_t;
+
+static volatile uint32_t bench_coros_left;
+
+/* Counts off one finished coroutine; the last one wakes the shell. */
+static void bench_coro_finish(uint32_t count) {
+    if (atomic_fetch_add32_acquire(&bench_coros_left, -count) == count) sem_post(&bench_done);
+}
+
+static int bench_coro_fn(coro_t *co) {
+    bench_coro_t *bc = (bench_coro_t *)co;
+    CORO_BEGIN(co);
+    for (bc->round = 0; bc->round < BENCH_CORO_ROUNDS; bc->round++) CORO_YIELD(co);
+    CORO_SLEEP_US(co, 1000);
+    bench_coro_finish(1);
+    CORO_END(co);
+}
+
 static void cmd_benchmark(int argc, char **argv) {
     UNUSED(argc); UNUSED(argv);
     uart_puts("\033[1mLareOS Benchmark\033[0m\n");
     uart_puts("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
 
-    uart_puts("[1/3] CPU Integer...\n");
+    uart_puts("[1/6] CPU Integer...\n");
     uint64_t start = timer_get_ticks();
     volatile uint64_t sum = 0;
     for (volatile uint64_t i = 0; i < 10000000; i++) {
@@ -381,7 +524,7 @@ static void cmd_benchmark(int argc, char **argv) {
     uart_putuint(10000000000ULL / (cpu_time + 1));
     uart_putc('\n');
 
-    uart_puts("[2/3] Memory...\n");
+    uart_puts("[2/6] Memory...\n");
     void *block = kmalloc(65536);
     start = timer_get_ticks();
     if (block) {
@@ -397,7 +540,7 @@ static void cmd_benchmark(int argc, char **argv) {
     uart_putuint(6400000000ULL / (mem_time + 1));
     uart_putc('\n');
 
-    uart_puts("[3/3] Alloc/Free...\n");
+    uart_puts("[3/6] Alloc/Free...\n");
     start = timer_get_ticks();
     for (int i = 0; i < 10000; i++) {
         void *p = kmalloc(64);
@@ -410,10 +553,88 @@ static void cmd_benchmark(int argc, char **argv) {
     uart_putuint(10000000000ULL / (alloc_time + 1));
     uart_putc('\n');
 
+    uart_puts("[4/6] Spawn/Exit...\n");
+    uint64_t spawn_time = 0;
+    uint64_t spawn_score = 0;
+    uint32_t spawned = 0;
+    task_t *self = task_get_current();
+    if (self) {
+        start = timer_get_ticks();
+        for (; spawned < BENCH_SPAWN_COUNT; spawned++) {
+            if (task_create("bench", bench_spawn_task, NULL, self->priority) < 0) break;
+            sem_wait(&bench_done);
+        }
+        spawn_time = timer_get_ticks() - start;
+        if (spawned == BENCH_SPAWN_COUNT) spawn_score = 2000000000ULL / (spawn_time + 1);
+    }
+    uart_puts("  Time: ");
+    uart_putuint(spawn_time / 1000);
+    uart_puts(" ms | ");
+    uart_putuint(spawned ? spawn_time / spawned : 0);
+    uart_puts(" us/task | Score: ");
+    uart_putuint(spawn_score);
+    uart_putc('\n');
+
+    uart_puts("[5/6] Yield Ping-Pong...\n");
+    uint64_t pingpong_ns = 0;
+    uint64_t pingpong_score = 0;
+    uint64_t switches = 0;
+    if (self) {
+        pingpong_cpu = smp_cpu_id();
+        pingpong_turn = 0;
+        pingpong_switches = 0;
+        uint64_t count = timer_counter();
+        int a = task_create("ping", bench_pingpong_task, (void *)0, self->priority);
+        int b = task_create("pong", bench_pingpong_task, (void *)1, self->priority);
+        if (a > 0) sem_wait(&bench_done);
+        if (b > 0) sem_wait(&bench_done);
+        pingpong_ns = timer_counter_to_ns(timer_counter() - count);
+        switches = pingpong_switches;
+        if (a > 0 && b > 0) pingpong_score = 2000000000000ULL / (pingpong_ns + 1);
+    }
+    uart_puts("  Time: ");
+    uart_putuint(pingpong_ns / 1000000);
+    uart_puts(" ms | ");
+    uart_putuint(switches ? pingpong_ns / switches : 0);
+    uart_puts(" ns/switch | Score: ");
+    uart_putuint(pingpong_score);
+    uart_putc('\n');
+
+    uart_puts("[6/6] Coroutines...\n");
+    uint64_t coro_ns = 0;
+    uint64_t coro_score = 0;
+    uint32_t started = 0;
+    bench_coro_t *coros = (bench_coro_t *)kmalloc(sizeof(bench_coro_t) * BENCH_CORO_COUNT);
+    executor_t *exec = executor_default();
+    if (self && coros && exec) {
+        bench_coros_left = BENCH_CORO_COUNT;
+        uint64_t count = timer_counter();
+        for (; started < BENCH_CORO_COUNT; started++) {
+            coro_init(&coros[started].co, bench_coro_fn, NULL);
+            if (!coro_start(exec, &coros[started].co)) break;
+        }
+        if (started < BENCH_CORO_COUNT) bench_coro_finish(BENCH_CORO_COUNT - started);
+        sem_wait(&bench_done);
+        coro_ns = timer_counter_to_ns(timer_counter() - count);
+        if (started == BENCH_CORO_COUNT) coro_score = 2000000000000ULL / (coro_ns + 1);
+    }
+    if (coros) kfree(coros);
+    uart_puts("  Time: ");
+    uart_putuint(coro_ns / 1000000);
+    uart_puts(" ms | ");
+    uart_putuint(started);
+    uart_puts(" x ");
+    uart_putuint(sizeof(bench_coro_t) + sizeof(coro_t *));
+    uart_puts(" B | ");
+    uart_putuint(started ? coro_ns / ((uint64_t)started * (BENCH_CORO_ROUNDS + 2)) : 0);
+    uart_puts(" ns/resume | Score: ");
+    uart_putuint(coro_score);
+    uart_putc('\n');
+
     uart_puts("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
-    uint64_t total = 10000000000ULL / (cpu_time + 1) + 6400000000ULL / (mem_time + 1) + 10000000000ULL / (alloc_time + 1);
+    uint64_t total = 10000000000ULL / (cpu_time + 1) + 6400000000ULL / (mem_time + 1) + 10000000000ULL / (alloc_time + 1) + spawn_score + pingpong_score + coro_score;
     uart_puts("\033[1mTotal Score: \033[36m");
-    uart_putuint(total / 3);
+    uart_putuint(total / 6);
     uart_puts("\033[0m\n");
 }
 
@@ -474,6 +695,150 @@ static void cmd_peekpoke(int argc, char **argv) {
     uart_putc('\n');
 }
 
+static void cmd_heapstat(int argc, char **argv) {
+    int max = argc > 1 ? atoi(argv[1]) : 10;
+    if (max <= 0) max = 10;
+
+    heap_site_t *top = (heap_site_t *)arena_alloc(shell_arena, sizeof(heap_site_t) * max);
+    if (!top) return;
+
+    int count = heap_profile_top(top, max);
+    if (count < 0) {
+        uart_puts("Heap profiling disabled (build with 'make heapprof')\n");
+        return;
+    }
+
+    uart_puts("\033[1mTop Heap Consumers\033[0m\n");
+    uart_puts("  Caller               Live      Bytes     Allocs\n");
+    for (int i = 0; i < count; i++) {
+        uart_puts("  ");
+        uart_puthex(top[i].caller);
+        uart_puts("  ");
+        uart_putuint(top[i].live_count);
+        uart_puts("  ");
+        uart_putuint(top[i].live_bytes);
+        uart_puts("  ");
+        uart_putuint(top[i].allocs);
+        uart_putc('\n');
+    }
+}
+
+static void cmd_locks(int argc, char **argv) {
+    UNUSED(argc); UNUSED(argv);
+
+    lock_stat_t **stats = (lock_stat_t **)arena_alloc(shell_arena, sizeof(lock_stat_t *) * LOCK_STAT_MAX);
+    if (!stats) return;
+    int count = lock_stat_list(stats, LOCK_STAT_MAX);
+
+    uart_puts("\033[1mLock Statistics\033[0m\n");
+    uart_puts("  Name              Acquired    Contended\n");
+    for (int i = 0; i < count; i++) {
+        uart_puts("  ");
+        uart_puts(stats[i]->name);
+        for (int pad = strlen(stats[i]->name); pad < 18; pad++) uart_putc(' ');
+        uart_putuint(stats[i]->acquired);
+        uart_puts("  ");
+        uart_putuint(stats[i]->contended);
+        uart_putc('\n');
+    }
+}
+
+/* Right-aligns `val` in a column `width` characters wide. */
+static void put_col(uint64_t val, int width) {
+    int digits = 1;
+    for (uint64_t v = val; v >= 10; v /= 10) digits++;
+    for (; digits < width; digits++) uart_putc(' ');
+    uart_putuint(val);
+}
+
+static task_stat_t *take_task_stats(int *count) {
+    int max = task_get_count() + NR_CPUS + 4;
+    task_stat_t *stats = (task_stat_t *)arena_alloc(shell_arena, sizeof(task_stat_t) * max);
+    *count = stats ? task_get_stats(stats, max) : 0;
+    return stats;
+}
+
+static void cmd_ps(int argc, char **argv) {
+    UNUSED(argc); UNUSED(argv);
+    int count;
+    task_stat_t *stats = take_task_stats(&count);
+    if (!stats) return;
+
+    uart_puts("\033[1m   ID CPU PRI  STATE    RUN(ms)   WAIT(ms)     VCSW    IVCSW  NAME\033[0m\n");
+    for (int i = 0; i < count; i++) {
+        task_stat_t *st = &stats[i];
+        const char *state = task_state_name(st->state);
+        put_col(st->id, 5);
+        put_col(st->cpu, 4);
+        put_col(st->priority, 4);
+        for (int pad = strlen(state); pad < 7; pad++) uart_putc(' ');
+        uart_puts(state);
+        put_col(st->runtime_ns / 1000000, 11);
+        put_col(st->wait_ns / 1000000, 11);
+        put_col(st->nvcsw, 9);
+        put_col(st->nivcsw, 9);
+        uart_puts("  ");
+        uart_puts(st->name);
+        uart_putc('\n');
+    }
+}
+
+static bool same_task(task_stat_t *a, task_stat_t *b) {
+    /* Idle tasks all have id 0. */
+    return a->id == b->id && (a->id || strcmp(a->name, b->name) == 0);
+}
+
+/* Samples twice, `top [seconds]` apart, and ranks tasks by the CPU time
+   they used in between; 100% is one core fully busy. */
+static void cmd_top(int argc, char **argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 1;
+    if (seconds <= 0) seconds = 1;
+
+    int before_count, after_count;
+    task_stat_t *before = take_task_stats(&before_count);
+    uint64_t start = timer_counter();
+    task_sleep_ms(seconds * 1000);
+    task_stat_t *after = take_task_stats(&after_count);
+    uint64_t interval = timer_counter_to_ns(timer_counter() - start);
+    int *order = (int *)arena_alloc(shell_arena, sizeof(int) * (after_count + 1));
+    if (!before || !after || !order || !interval) return;
+
+    /* Reuse runtime_ns in `after` for the time used during the sample. */
+    for (int i = 0; i < after_count; i++) {
+        for (int j = 0; j < before_count; j++) {
+            if (!same_task(&after[i], &before[j])) continue;
+            after[i].runtime_ns -= before[j].runtime_ns;
+            after[i].nvcsw -= before[j].nvcsw;
+            after[i].nivcsw -= before[j].nivcsw;
+            break;
+        }
+
+        int pos = i;
+        while (pos > 0 && after[order[pos - 1]].runtime_ns < after[i].runtime_ns) {
+            order[pos] = order[pos - 1];
+            pos--;
+        }
+        order[pos] = i;
+    }
+
+    uart_puts("\033[1m   ID CPU   CPU%  RUN(ms)   VCSW  IVCSW  NAME\033[0m\n");
+    for (int k = 0; k < after_count; k++) {
+        task_stat_t *st = &after[order[k]];
+        uint64_t permille = st->runtime_ns * 1000 / interval;
+        put_col(st->id, 5);
+        put_col(st->cpu, 4);
+        put_col(permille / 10, 5);
+        uart_putc('.');
+        uart_putuint(permille % 10);
+        put_col(st->runtime_ns / 1000000, 9);
+        put_col(st->nvcsw, 7);
+        put_col(st->nivcsw, 7);
+        uart_puts("  ");
+        uart_puts(st->name);
+        uart_putc('\n');
+    }
+}
+
 static void cmd_reboot(int argc, char **argv) {
     UNUSED(argc); UNUSED(argv);
     uart_puts("Rebooting...\n");
@@ -0,0 +1,140 @@
+#include "smp.h"
+#include "mmu.h"
+#include "timer.h"
+#include "string.h"
+#include "ipi.h"
+#include "fpsimd.h"
+
+#define SMP_BOOT_TIMEOUT    100000
+
+uint8_t cpu_stacks[NR_CPUS - 1][SMP_STACK_SIZE] __attribute__((aligned(16)));
+static percpu_t cpus[NR_CPUS] __attribute__((aligned(64)));
+static uint64_t local_tick_interval = 0;
+
+extern void secondary_start(void);
+extern void *exception_vector_table;
+
+uint32_t smp_cpu_id(void) {
+    uint64_t mpidr;
+    asm volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+    return mpidr & 0xFF;
+}
+
+static void local_timer_start(uint32_t cpu) {
+#ifndef NO_HZ
+    asm volatile("msr cntp_tval_el0, %0" :: "r"(local_tick_interval));
+    asm volatile("msr cntp_ctl_el0, %0" :: "r"(1ULL));
+#endif
+    mmio_write(LOCAL_TIMER_CTRL(cpu), LOCAL_IRQ_CNTPNS | LOCAL_IRQ_CNTV);
+}
+
+void smp_timer_tick(void) {
+#ifdef NO_HZ
+    /* One-shot: task_schedule() arms it again for the next slice. */
+    timer_slice_stop();
+#else
+    asm volatile("msr cntp_tval_el0, %0" :: "r"(local_tick_interval));
+#endif
+    this_cpu()->ticks++;
+}
+
+void smp_cpu_idle(void) {
+    percpu_t *pc = this_cpu();
+    while (1) {
+        pc->idle_loops++;
+        asm volatile("wfi");
+    }
+}
+
+void smp_secondary_main(uint64_t cpu) {
+    percpu_t *pc = &cpus[cpu];
+
+    asm volatile("msr tpidr_el1, %0" :: "r"(pc));
+    put_exception_vector(&exception_vector_table);
+    fpsimd_init_cpu();
+
+    pc->online_at = timer_get_ticks();
+    ipi_init_cpu(cpu);
+    local_timer_start(cpu);
+
+    asm volatile("dmb ish" ::: "memory");
+    pc->state = CPU_ONLINE;
+    asm volatile("sev");
+
+    enable_irq();
+    smp_cpu_idle();
+}
+
+static void release_cpu(uint32_t cpu) {
+    uint64_t slot = SPIN_TABLE_BASE + 8 * cpu;
+    uint64_t entry = (uint64_t)secondary_start;
+
+    asm volatile("str %0, [%1]" :: "r"(entry), "r"(slot) : "memory");
+    dcache_clean_range(slot, 8);
+}
+
+void smp_init(void) {
+    uint64_t freq;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    local_tick_interval = freq * TICK_INTERVAL / TIMER_FREQ;
+
+    memset(cpus, 0, sizeof(cpus));
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        cpus[cpu].id = cpu;
+        cpus[cpu].state = CPU_OFFLINE;
+        if (cpu > 0) cpus[cpu].stack_top = (uint64_t)cpu_stacks[cpu - 1] + SMP_STACK_SIZE;
+    }
+
+    cpus[0].state = CPU_ONLINE;
+    cpus[0].online_at = timer_get_ticks();
+    asm volatile("msr tpidr_el1, %0" :: "r"(&cpus[0]));
+    fpsimd_init_cpu();
+    ipi_init_cpu(0);
+
+#ifdef NO_HZ
+    local_timer_start(0);
+#else
+    /* Core 0 ticks from the system timer, but sleep deadlines still use
+       its local virtual timer. */
+    mmio_write(LOCAL_TIMER_CTRL(0), LOCAL_IRQ_CNTV);
+#endif
+
+    /* Secondaries run with caches off until their MMU is up; make sure no
+       dirty lines from the primary can land on top of their stacks later. */
+    dcache_clean_invalidate_range((uint64_t)cpu_stacks, sizeof(cpu_stacks));
+
+    for (uint32_t cpu = 1; cpu < NR_CPUS; cpu++) {
+        cpus[cpu].state = CPU_STARTING;
+        release_cpu(cpu);
+    }
+    asm volatile("sev");
+
+    for (uint32_t cpu = 1; cpu < NR_CPUS; cpu++) {
+        uint32_t timeout = SMP_BOOT_TIMEOUT;
+        while (cpus[cpu].state != CPU_ONLINE && timeout--) {
+            delay(10);
+        }
+        if (cpus[cpu].state != CPU_ONLINE) cpus[cpu].state = CPU_OFFLINE;
+    }
+}
+
+uint32_t smp_online_count(void) {
+    uint32_t count = 0;
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (cpus[cpu].state == CPU_ONLINE) count++;
+    }
+    return count;
+}
+
+percpu_t *smp_get_cpu(uint32_t cpu) {
+    if (cpu >= NR_CPUS) return NULL;
+    return &cpus[cpu];
+}
+
+const char *smp_state_name(uint32_t state) {
+    switch (state) {
+        case CPU_STARTING: return "starting";
+        case CPU_ONLINE:   return "online";
+        default:           return "offline";
+    }
+}
@@ -0,0 +1,143 @@
+#include "spinlock.h"
+
+static lock_stat_t *lock_stats[LOCK_STAT_MAX];
+static volatile uint32_t lock_stat_count = 0;
+
+/* Only locks with a name are listed; embed unnamed locks in objects that
+   can be freed so the table never points at released memory. */
+static void lock_stat_register(lock_stat_t *stat, const char *name) {
+    stat->name = name;
+    stat->acquired = 0;
+    stat->contended = 0;
+    if (!name) return;
+
+    uint32_t slot = atomic_fetch_add32_acquire(&lock_stat_count, 1);
+    if (slot < LOCK_STAT_MAX) lock_stats[slot] = stat;
+}
+
+int lock_stat_list(lock_stat_t **out, int max) {
+    uint32_t count = MIN(lock_stat_count, (uint32_t)LOCK_STAT_MAX);
+    int n = 0;
+    for (uint32_t i = 0; i < count && n < max; i++) {
+        if (lock_stats[i]) out[n++] = lock_stats[i];
+    }
+    return n;
+}
+
+void spin_lock_init(spinlock_t *lock, const char *name) {
+    lock->ticket = 0;
+    lock_stat_register(&lock->stat, name);
+}
+
+void spin_lock(spinlock_t *lock) {
+    uint32_t old = atomic_fetch_add32_acquire(&lock->ticket, 1 << 16);
+    uint16_t ticket = old >> 16;
+
+    if ((uint16_t)old != ticket) {
+        atomic_add64(&lock->stat.contended, 1);
+
+        uint32_t owner;
+        asm volatile("sevl");
+        do {
+            asm volatile("wfe");
+            asm volatile("ldaxrh %w0, %1" : "=r"(owner) : "Q"(lock->owner) : "memory");
+        } while ((uint16_t)owner != ticket);
+    }
+    lock->stat.acquired++;
+}
+
+bool spin_trylock(spinlock_t *lock) {
+    uint32_t old = lock->ticket;
+    if ((uint16_t)old != (uint16_t)(old >> 16)) return false;
+    if (!atomic_cmpxchg32_acquire(&lock->ticket, old, old + (1 << 16))) return false;
+    lock->stat.acquired++;
+    return true;
+}
+
+void spin_unlock(spinlock_t *lock) {
+    uint16_t next = lock->owner + 1;
+    asm volatile("stlrh %w1, %0" : "=Q"(lock->owner) : "r"(next) : "memory");
+}
+
+uint64_t spin_lock_irqsave(spinlock_t *lock) {
+    uint64_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+void rwlock_init(rwlock_t *lock, const char *name) {
+    lock->count = 0;
+    lock_stat_register(&lock->stat, name);
+}
+
+static void rwlock_wait(rwlock_t *lock, uint32_t busy) {
+    uint32_t count;
+    asm volatile("sevl");
+    do {
+        asm volatile("wfe");
+        asm volatile("ldaxr %w0, %1" : "=r"(count) : "Q"(lock->count) : "memory");
+    } while (count & busy);
+}
+
+void read_lock(rwlock_t *lock) {
+    bool waited = false;
+    while (1) {
+        uint32_t count = lock->count;
+        if (!(count & RWLOCK_WRITER) &&
+            atomic_cmpxchg32_acquire(&lock->count, count, count + 1)) break;
+
+        if (!waited) {
+            atomic_add64(&lock->stat.contended, 1);
+            waited = true;
+        }
+        rwlock_wait(lock, RWLOCK_WRITER);
+    }
+    atomic_add64(&lock->stat.acquired, 1);
+}
+
+void read_unlock(rwlock_t *lock) {
+    atomic_sub32_release(&lock->count, 1);
+}
+
+void write_lock(rwlock_t *lock) {
+    bool waited = false;
+    while (!atomic_cmpxchg32_acquire(&lock->count, 0, RWLOCK_WRITER)) {
+        if (!waited) {
+            atomic_add64(&lock->stat.contended, 1);
+            waited = true;
+        }
+        rwlock_wait(lock, ~0U);
+    }
+    lock->stat.acquired++;
+}
+
+void write_unlock(rwlock_t *lock) {
+    atomic_store32_release(&lock->count, 0);
+}
+
+uint64_t read_lock_irqsave(rwlock_t *lock) {
+    uint64_t flags = irq_save();
+    read_lock(lock);
+    return flags;
+}
+
+void read_unlock_irqrestore(rwlock_t *lock, uint64_t flags) {
+    read_unlock(lock);
+    irq_restore(flags);
+}
+
+uint64_t write_lock_irqsave(rwlock_t *lock) {
+    uint64_t flags = irq_save();
+    write_lock(lock);
+    return flags;
+}
+
+void write_unlock_irqrestore(rwlock_t *lock, uint64_t flags) {
+    write_unlock(lock);
+    irq_restore(flags);
+}
@@ -0,0 +1,321 @@
+#include "sync.h"
+#include "smp.h"
+#include "coroutine.h"
+
+/* Guards all mutex state. Order: wait queue lock, pi_lock, run queue. */
+static spinlock_t pi_lock;
+
+static void wait_relax(void) {
+    if (task_scheduler_running() && this_cpu()->irq_depth == 0) task_yield();
+}
+
+void sync_init(void) {
+    spin_lock_init(&pi_lock, "mutex");
+}
+
+static void waitlist_add(task_t **head, task_t *task) {
+    task_t **pp = head;
+    while (*pp && (*pp)->priority >= task->priority) pp = &(*pp)->wait_next;
+    task->wait_next = *pp;
+    *pp = task;
+}
+
+static bool waitlist_remove(task_t **head, task_t *task) {
+    for (task_t **pp = head; *pp; pp = &(*pp)->wait_next) {
+        if (*pp == task) {
+            *pp = task->wait_next;
+            task->wait_next = NULL;
+            return true;
+        }
+    }
+    return false;
+}
+
+void wait_queue_init(wait_queue_t *wq, const char *name) {
+    spin_lock_init(&wq->lock, name);
+    wq->head = NULL;
+    wq->coro_head = NULL;
+    wq->coro_tail = NULL;
+}
+
+/* Called and returns with wq->lock held; contexts that cannot block poll. */
+uint64_t wait_queue_wait_locked(wait_queue_t *wq, uint64_t flags) {
+    if (!task_can_block()) {
+        spin_unlock_irqrestore(&wq->lock, flags);
+        wait_relax();
+        return spin_lock_irqsave(&wq->lock);
+    }
+
+    task_t *self = task_get_current();
+    self->state = TASK_BLOCKED;
+    self->wait_queue = wq;
+    waitlist_add(&wq->head, self);
+
+    spin_unlock(&wq->lock);
+    task_block();
+    spin_lock(&wq->lock);
+    return flags;
+}
+
+/* Also returns once timer_get_ticks() passes `deadline`. A wakeup that
+   races with the timeout may be spent on this waiter. */
+uint64_t wait_queue_wait_timeout_locked(wait_queue_t *wq, uint64_t flags, uint64_t deadline) {
+    if (!task_can_block()) {
+        spin_unlock_irqrestore(&wq->lock, flags);
+        wait_relax();
+        return spin_lock_irqsave(&wq->lock);
+    }
+
+    task_t *self = task_get_current();
+    self->state = TASK_BLOCKED;
+    self->wait_queue = wq;
+    waitlist_add(&wq->head, self);
+
+    spin_unlock(&wq->lock);
+    task_block_until(deadline);
+    spin_lock(&wq->lock);
+
+    /* Timed out rather than woken: still on the list. */
+    if (self->wait_queue == wq) {
+        waitlist_remove(&wq->head, self);
+        self->wait_queue = NULL;
+    }
+    return flags;
+}
+
+bool wake_up_locked(wait_queue_t *wq) {
+    task_t *task = wq->head;
+    if (!task) {
+        coro_t *co = wq->coro_head;
+        if (!co) return false;
+        wq->coro_head = co->wait_next;
+        if (!wq->coro_head) wq->coro_tail = NULL;
+        coro_wake(co);
+        return true;
+    }
+
+    wq->head = task->wait_next;
+    task->wait_next = NULL;
+    task->wait_queue = NULL;
+    task_wake(task);
+    return true;
+}
+
+uint32_t wake_up_all_locked(wait_queue_t *wq) {
+    uint32_t n = 0;
+    while (wake_up_locked(wq)) n++;
+    return n;
+}
+
+bool wake_up(wait_queue_t *wq) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    bool woke = wake_up_locked(wq);
+    spin_unlock_irqrestore(&wq->lock, flags);
+    task_check_preempt();
+    return woke;
+}
+
+uint32_t wake_up_all(wait_queue_t *wq) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    uint32_t n = wake_up_all_locked(wq);
+    spin_unlock_irqrestore(&wq->lock, flags);
+    task_check_preempt();
+    return n;
+}
+
+static void pi_set_priority(task_t *task, uint8_t priority) {
+    if (task->priority == priority) return;
+
+    mutex_t *m = task->blocked_on;
+    if (m) waitlist_remove(&m->waiters, task);
+    task_boost_priority(task, priority);
+    if (m) waitlist_add(&m->waiters, task);
+}
+
+static uint8_t pi_owed_priority(task_t *task) {
+    uint8_t priority = task->base_priority;
+    for (mutex_t *m = task->held_mutexes; m; m = m->next_held) {
+        if (m->waiters && m->waiters->priority > priority) priority = m->waiters->priority;
+    }
+    return priority;
+}
+
+static void pi_propagate(mutex_t *m) {
+    for (int depth = 0; m && m->owner && depth < PI_MAX_DEPTH; depth++) {
+        task_t *owner = m->owner;
+        if (!m->waiters || m->waiters->priority <= owner->priority) break;
+
+        pi_set_priority(owner, m->waiters->priority);
+        m = owner->blocked_on;
+    }
+}
+
+static void held_push(task_t *task, mutex_t *m) {
+    m->next_held = task->held_mutexes;
+    task->held_mutexes = m;
+}
+
+static void held_remove(task_t *task, mutex_t *m) {
+    for (mutex_t **pp = &task->held_mutexes; *pp; pp = &(*pp)->next_held) {
+        if (*pp == m) {
+            *pp = m->next_held;
+            m->next_held = NULL;
+            return;
+        }
+    }
+}
+
+void sync_cancel_wait(task_t *task) {
+    wait_queue_t *wq = task->wait_queue;
+    if (wq) {
+        uint64_t flags = spin_lock_irqsave(&wq->lock);
+        if (task->wait_queue == wq) {
+            waitlist_remove(&wq->head, task);
+            task->wait_queue = NULL;
+        }
+        spin_unlock_irqrestore(&wq->lock, flags);
+    }
+
+    uint64_t flags = spin_lock_irqsave(&pi_lock);
+    mutex_t *m = task->blocked_on;
+    if (m) {
+        waitlist_remove(&m->waiters, task);
+        task->blocked_on = NULL;
+        if (m->owner) pi_set_priority(m->owner, pi_owed_priority(m->owner));
+    }
+    spin_unlock_irqrestore(&pi_lock, flags);
+}
+
+void mutex_init(mutex_t *m, const char *name) {
+    m->owner = NULL;
+    m->waiters = NULL;
+    m->next_held = NULL;
+    m->name = name;
+}
+
+/* A no-op until there is a current task to own the mutex. */
+void mutex_lock(mutex_t *m) {
+    task_t *self = task_get_current();
+    if (!self) return;
+
+    uint64_t flags = spin_lock_irqsave(&pi_lock);
+    while (m->owner != self) {
+        if (!m->owner) {
+            m->owner = self;
+            held_push(self, m);
+            break;
+        }
+
+        if (!task_can_block()) {
+            spin_unlock_irqrestore(&pi_lock, flags);
+            wait_relax();
+            flags = spin_lock_irqsave(&pi_lock);
+            continue;
+        }
+
+        self->state = TASK_BLOCKED;
+        self->blocked_on = m;
+        waitlist_add(&m->waiters, self);
+        pi_propagate(m);
+
+        /* mutex_unlock() hands ownership straight to the top waiter. */
+        spin_unlock(&pi_lock);
+        task_block();
+        spin_lock(&pi_lock);
+    }
+    spin_unlock_irqrestore(&pi_lock, flags);
+}
+
+bool mutex_trylock(mutex_t *m) {
+    task_t *self = task_get_current();
+    if (!self) return true;
+
+    uint64_t flags = spin_lock_irqsave(&pi_lock);
+    bool taken = !m->owner;
+    if (taken) {
+        m->owner = self;
+        held_push(self, m);
+    }
+    spin_unlock_irqrestore(&pi_lock, flags);
+    return taken;
+}
+
+static void mutex_release(mutex_t *m) {
+    task_t *self = task_get_current();
+    if (!self) return;
+
+    uint64_t flags = spin_lock_irqsave(&pi_lock);
+    held_remove(self, m);
+
+    task_t *next = m->waiters;
+    if (next) {
+        m->waiters = next->wait_next;
+        next->wait_next = NULL;
+        next->blocked_on = NULL;
+        m->owner = next;
+        held_push(next, m);
+        pi_set_priority(next, pi_owed_priority(next));
+    } else {
+        m->owner = NULL;
+    }
+
+    pi_set_priority(self, pi_owed_priority(self));
+    if (next) task_wake(next);
+    spin_unlock_irqrestore(&pi_lock, flags);
+}
+
+void mutex_unlock(mutex_t *m) {
+    mutex_release(m);
+    task_check_preempt();
+}
+
+void sem_init(semaphore_t *sem, const char *name, int32_t count) {
+    wait_queue_init(&sem->wait, name);
+    sem->count = count;
+}
+
+void sem_wait(semaphore_t *sem) {
+    uint64_t flags = spin_lock_irqsave(&sem->wait.lock);
+    while (sem->count <= 0) flags = wait_queue_wait_locked(&sem->wait, flags);
+    sem->count--;
+    spin_unlock_irqrestore(&sem->wait.lock, flags);
+}
+
+bool sem_trywait(semaphore_t *sem) {
+    uint64_t flags = spin_lock_irqsave(&sem->wait.lock);
+    bool taken = sem->count > 0;
+    if (taken) sem->count--;
+    spin_unlock_irqrestore(&sem->wait.lock, flags);
+    return taken;
+}
+
+/* Safe from interrupt handlers. */
+void sem_post(semaphore_t *sem) {
+    uint64_t flags = spin_lock_irqsave(&sem->wait.lock);
+    sem->count++;
+    wake_up_locked(&sem->wait);
+    spin_unlock_irqrestore(&sem->wait.lock, flags);
+    task_check_preempt();
+}
+
+void cond_init(condvar_t *cv, const char *name) {
+    wait_queue_init(&cv->wait, name);
+}
+
+/* The condvar lock is taken before the mutex is dropped, so no signal is
+   missed; callers re-check their predicate. */
+void cond_wait(condvar_t *cv, mutex_t *m) {
+    uint64_t flags = spin_lock_irqsave(&cv->wait.lock);
+    mutex_release(m);
+    flags = wait_queue_wait_locked(&cv->wait, flags);
+    spin_unlock_irqrestore(&cv->wait.lock, flags);
+    mutex_lock(m);
+}
+
+void cond_signal(condvar_t *cv) {
+    wake_up(&cv->wait);
+}
+
+void cond_broadcast(condvar_t *cv) {
+    wake_up_all(&cv->wait);
+}
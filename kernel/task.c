@@ -3,29 +3,495 @@
 #include "string.h"
 #include "timer.h"
 #include "uart.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "ipi.h"
+#include "sync.h"
 
-static task_t tasks[MAX_TASKS];
-static int current_task = 0;
+typedef struct {
+    task_t *head;
+    task_t *tail;
+} prio_queue_t;
+
+/* Bit n of `bitmap` is set while queue[n] is non-empty. Sleepers, and
+   blocked tasks with a timeout, are in a heap keyed on their deadline. */
+typedef struct {
+    spinlock_t lock;
+    uint32_t bitmap;
+    prio_queue_t queue[TASK_PRIO_LEVELS];
+    task_t **sleep_heap;
+    uint32_t sleep_cap;
+    uint64_t sleep_armed;
+    volatile uint32_t nr_queued;
+    uint32_t nr_sleeping;
+    uint32_t queued_affinity;
+    bool idle_kicked;
+} runqueue_t;
+
+#define SLEEP_HEAP_INITIAL  16
+
+static kmem_cache_t *task_cache;
+static task_t *task_list;
+static uint32_t nr_tasks;
+static uint8_t *stack_pool;
+static uint32_t stack_pool_count;
+static task_t idle_tasks[NR_CPUS];
+static runqueue_t runqueues[NR_CPUS];
+static uint32_t timeslices[TASK_PRIO_LEVELS];
 static uint32_t next_id = 1;
 static volatile bool scheduler_enabled = false;
+static spinlock_t task_lock;
+
+/* Zombies handed over by task_schedule_tail(), freed by reaper_task(). */
+static wait_queue_t reap_wait;
+static task_t *reap_list;
+static uint32_t reaper_id;
+
+static const char *idle_names[NR_CPUS] = { "idle0", "idle1", "idle2", "idle3" };
+static const char *rq_names[NR_CPUS] = { "rq0", "rq1", "rq2", "rq3" };
+
+static inline int rq_highest(runqueue_t *rq) {
+    if (!rq->bitmap) return -1;
+    return 31 - __builtin_clz(rq->bitmap);
+}
+
+static void rq_enqueue(runqueue_t *rq, task_t *task) {
+    prio_queue_t *q = &rq->queue[task->priority];
+    task->rq_next = NULL;
+    if (q->tail) q->tail->rq_next = task;
+    else q->head = task;
+    q->tail = task;
+    rq->bitmap |= 1U << task->priority;
+    rq->queued_affinity |= task->affinity;
+    rq->nr_queued++;
+}
+
+static void rq_enqueue_head(runqueue_t *rq, task_t *task) {
+    prio_queue_t *q = &rq->queue[task->priority];
+    task->rq_next = q->head;
+    q->head = task;
+    if (!q->tail) q->tail = task;
+    rq->bitmap |= 1U << task->priority;
+    rq->queued_affinity |= task->affinity;
+    rq->nr_queued++;
+}
+
+static void rq_remove(runqueue_t *rq, uint32_t prio, task_t *prev, task_t *task) {
+    prio_queue_t *q = &rq->queue[prio];
+    if (prev) prev->rq_next = task->rq_next;
+    else q->head = task->rq_next;
+    if (q->tail == task) q->tail = prev;
+    if (!q->head) rq->bitmap &= ~(1U << prio);
+    task->rq_next = NULL;
+    if (--rq->nr_queued == 0) {
+        rq->queued_affinity = 0;
+        rq->idle_kicked = false;
+    }
+}
+
+static void heap_set(runqueue_t *rq, uint32_t i, task_t *task) {
+    rq->sleep_heap[i] = task;
+    task->sleep_index = (int32_t)i;
+}
+
+static void heap_sift_up(runqueue_t *rq, uint32_t i) {
+    task_t *task = rq->sleep_heap[i];
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (rq->sleep_heap[parent]->sleep_until <= task->sleep_until) break;
+        heap_set(rq, i, rq->sleep_heap[parent]);
+        i = parent;
+    }
+    heap_set(rq, i, task);
+}
+
+static void heap_sift_down(runqueue_t *rq, uint32_t i) {
+    task_t *task = rq->sleep_heap[i];
+    uint32_t n = rq->nr_sleeping;
+    while (1) {
+        uint32_t child = 2 * i + 1;
+        if (child >= n) break;
+        if (child + 1 < n && rq->sleep_heap[child + 1]->sleep_until < rq->sleep_heap[child]->sleep_until) {
+            child++;
+        }
+        if (task->sleep_until <= rq->sleep_heap[child]->sleep_until) break;
+        heap_set(rq, i, rq->sleep_heap[child]);
+        i = child;
+    }
+    heap_set(rq, i, task);
+}
+
+static void sleeper_add(runqueue_t *rq, task_t *task) {
+    uint32_t i = rq->nr_sleeping++;
+    heap_set(rq, i, task);
+    heap_sift_up(rq, i);
+}
+
+static void sleeper_remove(runqueue_t *rq, task_t *task) {
+    uint32_t i = (uint32_t)task->sleep_index;
+    uint32_t last = --rq->nr_sleeping;
+    task->sleep_index = -1;
+    if (i == last) return;
+
+    heap_set(rq, i, rq->sleep_heap[last]);
+    if (i > 0 && rq->sleep_heap[(i - 1) / 2]->sleep_until > rq->sleep_heap[i]->sleep_until) {
+        heap_sift_up(rq, i);
+    } else {
+        heap_sift_down(rq, i);
+    }
+}
+
+/* Points this CPU's deadline timer at the earliest sleeper. Only valid for
+   the local run queue: the timer is a per-core register. */
+static void sleep_timer_update(runqueue_t *rq) {
+    uint64_t next = rq->nr_sleeping ? rq->sleep_heap[0]->sleep_until : 0;
+    if (next == rq->sleep_armed) return;
+
+    rq->sleep_armed = next;
+    if (next) timer_deadline_arm(next);
+    else timer_deadline_cancel();
+}
+
+static bool rq_unlink(runqueue_t *rq, task_t *task) {
+    task_t *prev = NULL;
+    for (task_t *t = rq->queue[task->priority].head; t; prev = t, t = t->rq_next) {
+        if (t == task) {
+            rq_remove(rq, task->priority, prev, task);
+            return true;
+        }
+    }
+
+    if (task->sleep_index >= 0) {
+        sleeper_remove(rq, task);
+        return true;
+    }
+    return false;
+}
+
+/* Pooled stacks are linked through their first word. */
+static uint8_t *stack_get(void) {
+    uint64_t flags = spin_lock_irqsave(&task_lock);
+    uint8_t *stack = stack_pool;
+    if (stack) {
+        stack_pool = *(uint8_t **)stack;
+        stack_pool_count--;
+    }
+    spin_unlock_irqrestore(&task_lock, flags);
+
+    if (!stack) stack = (uint8_t *)page_alloc(TASK_STACK_SIZE / PAGE_SIZE);
+    return stack;
+}
+
+static task_t *task_find(uint32_t id) {
+    for (task_t *task = task_list; task; task = task->all_next) {
+        if (task->id == id) return task;
+    }
+    return NULL;
+}
+
+static void task_release(task_t *task) {
+    uint8_t *stack = task->stack_base;
+
+    uint64_t flags = spin_lock_irqsave(&task_lock);
+    if (task->all_prev) task->all_prev->all_next = task->all_next;
+    else task_list = task->all_next;
+    if (task->all_next) task->all_next->all_prev = task->all_prev;
+    nr_tasks--;
+
+    if (stack && stack_pool_count < TASK_STACK_POOL) {
+        *(uint8_t **)stack = stack_pool;
+        stack_pool = stack;
+        stack_pool_count++;
+        stack = NULL;
+    }
+    spin_unlock_irqrestore(&task_lock, flags);
+
+    if (stack) page_free(stack);
+    kmem_cache_free(task_cache, task);
+}
+
+/* The scheduler collects zombies on pc->dead while it holds run queue
+   locks; task_schedule_tail() passes them on once they are off the CPU. */
+static void reap_defer(percpu_t *pc, task_t *task) {
+    task->rq_next = pc->dead;
+    pc->dead = task;
+}
+
+static void reap_queue(percpu_t *pc) {
+    task_t *list = pc->dead;
+    pc->dead = NULL;
+
+    uint64_t flags = spin_lock_irqsave(&reap_wait.lock);
+    while (list) {
+        task_t *next = list->rq_next;
+        list->rq_next = reap_list;
+        reap_list = list;
+        list = next;
+    }
+    wake_up_locked(&reap_wait);
+    spin_unlock_irqrestore(&reap_wait.lock, flags);
+}
+
+static void reaper_task(void *arg) {
+    UNUSED(arg);
+    while (1) {
+        uint64_t flags = spin_lock_irqsave(&reap_wait.lock);
+        while (!reap_list) flags = wait_queue_wait_locked(&reap_wait, flags);
+        task_t *list = reap_list;
+        reap_list = NULL;
+        spin_unlock_irqrestore(&reap_wait.lock, flags);
+
+        while (list) {
+            task_t *next = list->rq_next;
+            task_release(list);
+            list = next;
+        }
+    }
+}
+
+/* sleeper_add() must never allocate. */
+static bool sleep_heaps_reserve(uint32_t count) {
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        runqueue_t *rq = &runqueues[cpu];
+        uint32_t cap = rq->sleep_cap;
+        if (cap >= count) continue;
+        while (cap < count) cap *= 2;
+
+        task_t **heap = (task_t **)kmalloc(cap * sizeof(task_t *));
+        if (!heap) return false;
+
+        uint64_t flags = spin_lock_irqsave(&rq->lock);
+        task_t **old = heap;
+        if (rq->sleep_cap < cap) {
+            memcpy(heap, rq->sleep_heap, rq->nr_sleeping * sizeof(task_t *));
+            old = rq->sleep_heap;
+            rq->sleep_heap = heap;
+            rq->sleep_cap = cap;
+        }
+        spin_unlock_irqrestore(&rq->lock, flags);
+        kfree(old);
+    }
+    return true;
+}
+
+static uint32_t cpu_load(uint32_t cpu) {
+    percpu_t *pc = smp_get_cpu(cpu);
+    return runqueues[cpu].nr_queued + (pc->current && pc->current != pc->idle);
+}
+
+static uint32_t select_cpu(task_t *task) {
+    uint32_t best = 0;
+    uint32_t best_load = ~0U;
+
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (!(task->affinity & CPU_MASK(cpu))) continue;
+        if (smp_get_cpu(cpu)->state != CPU_ONLINE) continue;
+
+        uint32_t load = cpu_load(cpu);
+        if (load < best_load) {
+            best = cpu;
+            best_load = load;
+        }
+    }
+
+    uint32_t last = task->cpu;
+    if (best_load != ~0U && (task->affinity & CPU_MASK(last)) &&
+        smp_get_cpu(last)->state == CPU_ONLINE && cpu_load(last) <= best_load) {
+        return last;
+    }
+    return best;
+}
+
+static bool should_preempt(percpu_t *pc, task_t *task) {
+    task_t *cur = pc->current;
+    return cur == pc->idle || task->priority > cur->priority;
+}
+
+static void resched_cpu(uint32_t cpu) {
+    if (cpu == smp_cpu_id()) this_cpu()->need_resched = 1;
+    else ipi_send(cpu, IPI_RESCHEDULE);
+}
+
+/* Called with rq->lock held. Idle cores do not tick under NO_HZ, so one
+   that some queued task may run on is woken to steal it, once per stretch
+   in which `rq` is non-empty. Ticking idle cores find the work themselves. */
+static void rq_kick_idle(runqueue_t *rq, uint32_t self) {
+#ifdef NO_HZ
+    if (!rq->nr_queued || rq->idle_kicked) return;
+
+    uint32_t mask = rq->queued_affinity & ~CPU_MASK(self);
+    for (uint32_t cpu = 0; mask; cpu++) {
+        if (!(mask & CPU_MASK(cpu))) continue;
+        mask &= ~CPU_MASK(cpu);
+
+        percpu_t *pc = smp_get_cpu(cpu);
+        if (pc->state == CPU_ONLINE && pc->current == pc->idle) {
+            ipi_send(cpu, IPI_RESCHEDULE);
+            rq->idle_kicked = true;
+            return;
+        }
+    }
+#else
+    UNUSED(rq);
+    UNUSED(self);
+#endif
+}
+
+/* For the calling CPU this only sets need_resched; task context follows
+   up with task_check_preempt(). */
+static void task_enqueue(task_t *task) {
+    uint32_t cpu = select_cpu(task);
+    runqueue_t *rq = &runqueues[cpu];
+    bool ready;
+
+    bool preempt = false;
+
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    task->cpu = cpu;
+    ready = task->state != TASK_SLEEPING;
+    if (ready) {
+        rq_enqueue(rq, task);
+        preempt = should_preempt(smp_get_cpu(cpu), task);
+        if (!preempt) rq_kick_idle(rq, cpu);
+    } else {
+        sleeper_add(rq, task);
+        if (cpu == smp_cpu_id()) sleep_timer_update(rq);
+    }
+    bool new_deadline = !ready && rq->sleep_heap[0] == task;
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    if (!ready) {
+        /* A remote core's deadline timer can only be rearmed by that core;
+           task_schedule() there picks up the new root. */
+        if (new_deadline && cpu != smp_cpu_id()) ipi_send(cpu, IPI_RESCHEDULE);
+        return;
+    }
+
+    if (preempt) resched_cpu(cpu);
+}
+
+static void task_preempt(void) {
+    uint64_t flags = irq_save();
+    task_schedule();
+    irq_restore(flags);
+}
+
+bool task_can_block(void) {
+    if (!scheduler_enabled) return false;
+    percpu_t *pc = this_cpu();
+    return pc->current != pc->idle && pc->irq_depth == 0;
+}
+
+/* A no-op in interrupt context; the exit path reschedules instead. */
+void task_check_preempt(void) {
+    if (!scheduler_enabled) return;
+    percpu_t *pc = this_cpu();
+    if (pc->need_resched && pc->irq_depth == 0) task_preempt();
+}
+
+/* The caller has set TASK_BLOCKED and queued itself with IRQs masked.
+   If task_wake() already made it READY, this returns at once. */
+void task_block(void) {
+    task_get_current()->sleep_until = 0;
+    task_schedule();
+}
+
+/* On timeout the task is still on its wait list; the caller takes
+   itself off. */
+void task_block_until(uint64_t deadline) {
+    task_get_current()->sleep_until = deadline ? deadline : 1;
+    task_schedule();
+}
+
+void task_wake(task_t *task) {
+    runqueue_t *rq = &runqueues[task->cpu];
+    bool parked = false;
+
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    if (task->state == TASK_BLOCKED) {
+        task->state = TASK_READY;
+        task->acct_stamp = timer_counter();
+        parked = task->parked;
+        task->parked = 0;
+        if (task->sleep_index >= 0) sleeper_remove(rq, task);
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    /* Still switching out: task_schedule() requeues it itself. */
+    if (parked) task_enqueue(task);
+}
+
+void task_boost_priority(task_t *task, uint8_t priority) {
+    uint32_t cpu = task->cpu;
+    runqueue_t *rq = &runqueues[cpu];
+
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    bool requeue = task->state == TASK_READY && rq_unlink(rq, task);
+    task->priority = priority;
+    if (requeue) rq_enqueue(rq, task);
+    bool outranked = task->state == TASK_RUNNING && rq_highest(rq) > (int)priority;
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    if ((requeue && should_preempt(smp_get_cpu(cpu), task)) || outranked) resched_cpu(cpu);
+}
+
+static void idle_setup(uint32_t cpu) {
+    task_t *idle = &idle_tasks[cpu];
+    percpu_t *pc = smp_get_cpu(cpu);
+
+    memset(idle, 0, sizeof(task_t));
+    idle->state = TASK_RUNNING;
+    strncpy(idle->name, idle_names[cpu], TASK_NAME_LEN);
+    idle->created_at = timer_get_ticks();
+    idle->acct_stamp = timer_counter();
+    idle->affinity = CPU_MASK(cpu);
+    idle->cpu = cpu;
+    idle->on_cpu = 1;
+    idle->sleep_index = -1;
+    fpsimd_init_task(idle);
+    pc->need_resched = 0;
+    pc->irq_depth = 0;
+
+    /* Every core's boot context becomes its idle task: secondaries are
+       already in smp_cpu_idle(), and kernel_main ends up there too. */
+    pc->idle = idle;
+    pc->prev = NULL;
+    pc->dead = NULL;
+    pc->current = idle;
+}
 
 void task_init(void) {
-    memset(tasks, 0, sizeof(tasks));
+    spin_lock_init(&task_lock, "tasks");
+    wait_queue_init(&reap_wait, "reaper");
+    task_cache = kmem_cache_create("task", sizeof(task_t));
+
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        runqueue_t *rq = &runqueues[cpu];
+        memset(rq, 0, sizeof(runqueue_t));
+        spin_lock_init(&rq->lock, rq_names[cpu]);
+        rq->sleep_heap = (task_t **)kmalloc(SLEEP_HEAP_INITIAL * sizeof(task_t *));
+        rq->sleep_cap = SLEEP_HEAP_INITIAL;
+    }
 
-    tasks[0].state = TASK_RUNNING;
-    tasks[0].id = next_id++;
-    strncpy(tasks[0].name, "kernel", TASK_NAME_LEN);
-    tasks[0].stack_base = NULL;
-    tasks[0].stack_size = 0;
-    tasks[0].created_at = timer_get_ticks();
-    tasks[0].priority = 5;
+    for (uint32_t prio = 0; prio < TASK_PRIO_LEVELS; prio++) {
+        if (prio >= TASK_PRIO_HIGH) timeslices[prio] = 2;
+        else if (prio >= TASK_PRIO_NORMAL) timeslices[prio] = 5;
+        else timeslices[prio] = 10;
+    }
+
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (smp_get_cpu(cpu)->state == CPU_ONLINE) idle_setup(cpu);
+    }
 
-    current_task = 0;
+    asm volatile("dmb ish" ::: "memory");
     scheduler_enabled = true;
+
+    int id = task_create("reaper", reaper_task, NULL, TASK_PRIO_HIGH);
+    if (id > 0) reaper_id = (uint32_t)id;
 }
 
 void task_entry_wrapper(void) {
-    task_t *task = &tasks[current_task];
+    task_t *task = task_get_current();
     if (task->entry) {
         task->entry(task->arg);
     }
@@ -33,138 +499,532 @@ void task_entry_wrapper(void) {
 }
 
 int task_create(const char *name, task_entry_t entry, void *arg, uint8_t priority) {
-    int slot = -1;
-    for (int i = 0; i < MAX_TASKS; i++) {
-        if (tasks[i].state == TASK_UNUSED) {
-            slot = i;
-            break;
-        }
-    }
-    if (slot < 0) return -1;
+    task_t *task = (task_t *)kmem_cache_alloc(task_cache);
+    if (!task) return -1;
 
-    uint8_t *stack = (uint8_t *)page_alloc(TASK_STACK_SIZE / PAGE_SIZE);
-    if (!stack) return -1;
-
-    memset(stack, 0, TASK_STACK_SIZE);
+    uint8_t *stack = stack_get();
+    if (!stack) {
+        kmem_cache_free(task_cache, task);
+        return -1;
+    }
 
-    task_t *task = &tasks[slot];
     memset(task, 0, sizeof(task_t));
 
     task->state = TASK_READY;
-    task->id = next_id++;
     strncpy(task->name, name ? name : "unnamed", TASK_NAME_LEN);
     task->stack_base = stack;
     task->stack_size = TASK_STACK_SIZE;
     task->created_at = timer_get_ticks();
-    task->priority = priority;
+    task->acct_stamp = timer_counter();
+    task->priority = priority > TASK_PRIO_MAX ? TASK_PRIO_MAX : priority;
+    task->base_priority = task->priority;
     task->entry = entry;
     task->arg = arg;
+    task->affinity = CPU_MASK_ALL;
+    task->cpu = smp_cpu_id();
+    task->sleep_index = -1;
+    fpsimd_init_task(task);
 
     uint64_t stack_top = (uint64_t)stack + TASK_STACK_SIZE;
     stack_top &= ~0xFULL;
 
+    /* The first switch to the task "returns" into task_start. */
+    task->context.fp = 0;
+    task->context.lr = (uint64_t)task_start;
     task->context.sp = stack_top;
-    task->context.elr = (uint64_t)task_entry_wrapper;
-    task->context.spsr = 0x345;
-    task->context.x[0] = (uint64_t)arg;
-    task->context.x[29] = 0;
-    task->context.x[30] = (uint64_t)task_entry_wrapper;
 
-    return (int)task->id;
+    uint64_t flags = spin_lock_irqsave(&task_lock);
+    task->id = next_id++;
+    task->all_next = task_list;
+    if (task_list) task_list->all_prev = task;
+    task_list = task;
+    uint32_t count = ++nr_tasks;
+    spin_unlock_irqrestore(&task_lock, flags);
+
+    int id = (int)task->id;
+    if (!sleep_heaps_reserve(count)) {
+        task_release(task);
+        return -1;
+    }
+
+    task_enqueue(task);
+    task_check_preempt();
+    return id;
 }
 
-static int find_next_task(void) {
-    int start = current_task;
-    int next = start;
+int task_set_affinity(uint32_t id, uint32_t mask) {
+    mask &= CPU_MASK_ALL;
+    if (!mask) return -1;
+
+    uint64_t tflags = spin_lock_irqsave(&task_lock);
+    task_t *task = task_find(id);
+    if (!task) {
+        spin_unlock_irqrestore(&task_lock, tflags);
+        return -1;
+    }
+
+    runqueue_t *rq = &runqueues[task->cpu];
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    task->affinity = mask;
+    if (task->state == TASK_READY) {
+        rq->queued_affinity |= mask;
+        rq_kick_idle(rq, task->cpu);
+    }
 
-    for (int i = 0; i < MAX_TASKS; i++) {
-        next = (start + 1 + i) % MAX_TASKS;
-        if (tasks[next].state == TASK_SLEEPING) {
-            if (timer_get_ticks() >= tasks[next].sleep_until) {
-                tasks[next].state = TASK_READY;
+    /* A blocked task, even one in the sleep heap for a timed wait, is
+       placed by task_wake() or its timeout instead. */
+    bool moved = false;
+    bool queued = task->state == TASK_READY || task->state == TASK_SLEEPING;
+    if (!(mask & CPU_MASK(task->cpu)) && !task->on_cpu && queued) {
+        moved = rq_unlink(rq, task);
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+    spin_unlock_irqrestore(&task_lock, tflags);
+
+    /* Off every queue, so not reapable until it is enqueued again. */
+    if (moved) {
+        task_enqueue(task);
+        task_check_preempt();
+    }
+    return 0;
+}
+
+int task_set_priority(uint32_t id, uint8_t priority) {
+    if (priority > TASK_PRIO_MAX) return -1;
+
+    uint64_t tflags = spin_lock_irqsave(&task_lock);
+    task_t *task = task_find(id);
+    if (!task) {
+        spin_unlock_irqrestore(&task_lock, tflags);
+        return -1;
+    }
+
+    /* A boost outranks the new base until the inheritance is dropped. */
+    task->base_priority = priority;
+    if (task->held_mutexes && task->priority > priority) priority = task->priority;
+    task_boost_priority(task, priority);
+    spin_unlock_irqrestore(&task_lock, tflags);
+
+    task_check_preempt();
+    return 0;
+}
+
+int task_set_timeslice(uint8_t priority, uint32_t ticks) {
+    if (priority > TASK_PRIO_MAX || ticks == 0) return -1;
+    timeslices[priority] = ticks;
+    return 0;
+}
+
+uint32_t task_get_timeslice(uint8_t priority) {
+    if (priority > TASK_PRIO_MAX) return 0;
+    return timeslices[priority];
+}
+
+/* Only `current` may be picked while still flagged on_cpu. */
+static task_t *pick_next(runqueue_t *rq, task_t *current) {
+    uint32_t pending = rq->bitmap;
+
+    while (pending) {
+        uint32_t prio = 31 - __builtin_clz(pending);
+        task_t *prev = NULL;
+        task_t *task = rq->queue[prio].head;
+
+        while (task) {
+            task_t *next = task->rq_next;
+
+            if (task->state == TASK_ZOMBIE && !task->on_cpu) {
+                rq_remove(rq, prio, prev, task);
+                reap_defer(this_cpu(), task);
+                task = next;
+                continue;
+            }
+
+            if (task->state == TASK_READY && (!task->on_cpu || task == current)) {
+                rq_remove(rq, prio, prev, task);
+                return task;
             }
+
+            prev = task;
+            task = next;
+        }
+        pending &= ~(1U << prio);
+    }
+    return NULL;
+}
+
+static task_t *steal_task(uint32_t cpu) {
+    for (uint32_t i = 1; i < NR_CPUS; i++) {
+        uint32_t victim = (cpu + i) % NR_CPUS;
+        runqueue_t *rq = &runqueues[victim];
+        if (rq->nr_queued == 0) continue;
+        if (!spin_trylock(&rq->lock)) continue;
+
+        task_t *found = NULL, *found_prev = NULL;
+        uint32_t found_prio = 0;
+        uint32_t pending = rq->bitmap;
+        while (pending && !found) {
+            uint32_t prio = 31 - __builtin_clz(pending);
+            task_t *prev = NULL;
+            for (task_t *t = rq->queue[prio].head; t; prev = t, t = t->rq_next) {
+                if (t->state == TASK_READY && !t->on_cpu && (t->affinity & CPU_MASK(cpu))) {
+                    found = t;
+                    found_prev = prev;
+                    found_prio = prio;
+                }
+            }
+            pending &= ~(1U << prio);
         }
-        if (tasks[next].state == TASK_READY) {
-            return next;
+        if (found) rq_remove(rq, found_prio, found_prev, found);
+        spin_unlock(&rq->lock);
+
+        if (found) {
+            this_cpu()->steals++;
+            return found;
         }
     }
+    return NULL;
+}
 
-    if (tasks[start].state == TASK_RUNNING || tasks[start].state == TASK_READY) {
-        return start;
+static void wake_sleepers(runqueue_t *rq) {
+    if (!rq->nr_sleeping) return;
+
+    uint64_t now = timer_get_ticks();
+    uint64_t stamp = timer_counter();
+    while (rq->nr_sleeping && rq->sleep_heap[0]->sleep_until <= now) {
+        task_t *task = rq->sleep_heap[0];
+        sleeper_remove(rq, task);
+        if (task->state == TASK_SLEEPING || task->state == TASK_BLOCKED) task->state = TASK_READY;
+        task->parked = 0;
+        task->acct_stamp = stamp;
+        rq_enqueue(rq, task);
     }
+}
 
-    return 0;
+/* Charges the time since the task's last stamp as CPU time. */
+static void acct_run(task_t *task, uint64_t now) {
+    task->runtime_ns += timer_counter_to_ns(now - task->acct_stamp);
+    task->acct_stamp = now;
+}
+
+/* Charges the time since the task last became runnable as waiting. */
+static void acct_wait(task_t *task, uint64_t now) {
+    task->wait_ns += timer_counter_to_ns(now - task->acct_stamp);
+    task->acct_stamp = now;
 }
 
-uint64_t task_schedule(uint64_t current_sp) {
-    if (!scheduler_enabled) return current_sp;
+static bool should_switch(runqueue_t *rq, percpu_t *pc) {
+    task_t *cur = pc->current;
+    if (cur == pc->idle) return rq->bitmap != 0;
+    return cur->state != TASK_RUNNING || rq_highest(rq) > (int)cur->priority;
+}
+
+/* Called from the local timer interrupt; returns true to switch. */
+bool task_tick(void) {
+    if (!scheduler_enabled) return false;
+
+    percpu_t *pc = this_cpu();
+    runqueue_t *rq = &runqueues[pc->id];
+    task_t *cur = pc->current;
+    bool resched;
+
+    spin_lock(&rq->lock);
+    wake_sleepers(rq);
+    sleep_timer_update(rq);
+
+    if (cur == pc->idle) {
+        resched = true;
+    } else {
+#ifdef NO_HZ
+        cur->slice_left = 0;
+#else
+        if (cur->slice_left) cur->slice_left--;
+#endif
+        resched = cur->slice_left == 0 || should_switch(rq, pc);
+    }
+    spin_unlock(&rq->lock);
+    return resched;
+}
+
+/* Called when the deadline timer programmed by sleep_timer_update() fires,
+   which can be well before the next tick. */
+bool task_deadline_expired(void) {
+    timer_deadline_cancel();
+    if (!scheduler_enabled) return false;
+
+    percpu_t *pc = this_cpu();
+    runqueue_t *rq = &runqueues[pc->id];
+    bool resched;
+
+    spin_lock(&rq->lock);
+    rq->sleep_armed = 0;
+    wake_sleepers(rq);
+    sleep_timer_update(rq);
+    resched = should_switch(rq, pc);
+    if (!resched) rq_kick_idle(rq, pc->id);
+    spin_unlock(&rq->lock);
+    return resched;
+}
+
+/* Puts `prev` back wherever its state says and picks what runs next. */
+static task_t *schedule_next(percpu_t *pc, task_t *prev) {
+    uint32_t cpu = pc->id;
+    runqueue_t *rq = &runqueues[cpu];
+
+    /* A task that blocked, slept, exited or yielded gave the CPU up; one
+       still RUNNING was preempted. */
+    uint64_t now = timer_counter();
+    acct_run(prev, now);
+    bool voluntary = prev->state != TASK_RUNNING || prev->yielded;
+    prev->yielded = 0;
+
+#ifdef NO_HZ
+    /* Charge the slice for the time actually used, rounding up so that
+       frequent short preemptions cannot stretch it indefinitely. */
+    if (prev != pc->idle && prev->slice_left) {
+        uint32_t used = timer_slice_elapsed(pc->slice_stamp);
+        prev->slice_left = used >= prev->slice_left ? 0 : prev->slice_left - used;
+    }
+#endif
 
-    tasks[current_task].context.sp = current_sp;
-    tasks[current_task].cpu_ticks++;
+    pc->need_resched = 0;
 
-    if (tasks[current_task].state == TASK_RUNNING) {
-        tasks[current_task].state = TASK_READY;
+    /* Once a blocked task is parked, task_wake() may requeue it. */
+    bool migrate = false;
+
+    spin_lock(&rq->lock);
+    if (prev != pc->idle) {
+        if (prev->state == TASK_RUNNING) prev->state = TASK_READY;
+
+        if (prev->state == TASK_ZOMBIE) {
+            reap_defer(pc, prev);
+        } else if (prev->state == TASK_BLOCKED) {
+            prev->parked = 1;
+            if (prev->sleep_until) sleeper_add(rq, prev);
+        } else if (!(prev->affinity & CPU_MASK(cpu))) {
+            migrate = true;
+        } else if (prev->state == TASK_SLEEPING) {
+            sleeper_add(rq, prev);
+        } else if (prev->slice_left) {
+            rq_enqueue_head(rq, prev);
+        } else {
+            rq_enqueue(rq, prev);
+        }
+    } else if (prev->state == TASK_RUNNING) {
+        prev->state = TASK_READY;
     }
 
-    int next = find_next_task();
+    task_t *next = pick_next(rq, prev);
+    sleep_timer_update(rq);
+    rq_kick_idle(rq, cpu);
+    spin_unlock(&rq->lock);
+
+    if (migrate) task_enqueue(prev);
 
-    for (int i = 0; i < MAX_TASKS; i++) {
-        if (tasks[i].state == TASK_ZOMBIE && tasks[i].stack_base) {
-            page_free(tasks[i].stack_base, tasks[i].stack_size / PAGE_SIZE);
-            tasks[i].stack_base = NULL;
-            tasks[i].state = TASK_UNUSED;
+    if (!next) next = steal_task(cpu);
+    if (!next) next = pc->idle;
+
+    if (next != prev) {
+        fpsimd_switch_out(prev);
+        if (prev != pc->idle) {
+            if (voluntary) prev->nvcsw++;
+            else prev->nivcsw++;
         }
+        if (next != pc->idle) acct_wait(next, now);
+        else next->acct_stamp = now;
     }
 
-    current_task = next;
-    tasks[current_task].state = TASK_RUNNING;
+    if (!next->slice_left) next->slice_left = timeslices[next->priority];
+
+#ifdef NO_HZ
+    /* Idle runs with no tick at all; anything else gets one interrupt at
+       the end of its slice instead of one per TICK_INTERVAL. */
+    if (next == pc->idle) {
+        timer_slice_stop();
+    } else {
+        timer_slice_arm(next->slice_left);
+        pc->slice_stamp = timer_slice_stamp();
+    }
+#endif
 
-    return tasks[current_task].context.sp;
+    next->state = TASK_RUNNING;
+    next->cpu = cpu;
+    next->on_cpu = 1;
+    pc->prev = prev;
+    pc->current = next;
+    return next;
+}
+
+/* Switches to the next task, saving only callee-saved registers: every
+   caller, interrupt exit included, reaches here through a C call. Runs
+   with IRQs masked and returns once the caller is picked again, possibly
+   on another core. */
+void task_schedule(void) {
+    if (!scheduler_enabled) return;
+
+    percpu_t *pc = this_cpu();
+    task_t *prev = pc->current;
+    task_t *next = schedule_next(pc, prev);
+
+    if (next != prev) context_switch(&prev->context, &next->context);
+    task_schedule_tail();
+}
+
+/* Runs on the incoming task's stack once the outgoing context is saved,
+   so the outgoing task can now be picked up by another core. */
+void task_schedule_tail(void) {
+    if (!scheduler_enabled) return;
+
+    percpu_t *pc = this_cpu();
+    task_t *prev = pc->prev;
+    if (prev && prev != pc->current) {
+        asm volatile("dmb ish" ::: "memory");
+        prev->on_cpu = 0;
+    }
+    pc->prev = NULL;
+
+    if (pc->dead) reap_queue(pc);
 }
 
 void task_yield(void) {
-    asm volatile("svc #0");
+    task_t *task = task_get_current();
+    uint64_t flags = irq_save();
+    if (task) {
+        task->slice_left = 0;
+        task->yielded = 1;
+    }
+    task_schedule();
+    irq_restore(flags);
 }
 
 void task_exit(void) {
-    disable_irq();
-    tasks[current_task].state = TASK_ZOMBIE;
-    enable_irq();
+    uint64_t flags = irq_save();
+    task_get_current()->state = TASK_ZOMBIE;
+    irq_restore(flags);
     task_yield();
     while (1) { asm volatile("wfe"); }
 }
 
-void task_sleep_ms(uint32_t ms) {
-    disable_irq();
-    tasks[current_task].state = TASK_SLEEPING;
-    tasks[current_task].sleep_until = timer_get_ticks() + (uint64_t)ms * 1000;
-    enable_irq();
+void task_sleep_us(uint64_t us) {
+    task_t *task = task_get_current();
+    if (task == this_cpu()->idle) {
+        /* The idle task is never parked; just let other work run. */
+        task_yield();
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    task->state = TASK_SLEEPING;
+    task->sleep_until = timer_get_ticks() + us;
+    irq_restore(flags);
     task_yield();
 }
 
+void task_sleep_ms(uint32_t ms) {
+    task_sleep_us((uint64_t)ms * 1000);
+}
+
 int task_kill(uint32_t id) {
-    for (int i = 0; i < MAX_TASKS; i++) {
-        if (tasks[i].id == id && tasks[i].state != TASK_UNUSED) {
-            if (i == 0) return -1;
-            tasks[i].state = TASK_ZOMBIE;
-            return 0;
-        }
+    uint64_t tflags = spin_lock_irqsave(&task_lock);
+    task_t *task = task_find(id);
+
+    /* A zombie may already be on its way to the reaper, which itself must
+       stay alive to free anything at all. */
+    if (!task || task->state == TASK_ZOMBIE || task->id == reaper_id) {
+        spin_unlock_irqrestore(&task_lock, tflags);
+        return -1;
     }
-    return -1;
+
+    if (task->state == TASK_BLOCKED) sync_cancel_wait(task);
+
+    /* Requeue it so that pick_next() reaps it now. */
+    runqueue_t *rq = &runqueues[task->cpu];
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    if (task->sleep_index >= 0) {
+        sleeper_remove(rq, task);
+        task->parked = 0;
+        task->state = TASK_ZOMBIE;
+        rq_enqueue(rq, task);
+    } else if (task->parked) {
+        task->parked = 0;
+        task->state = TASK_ZOMBIE;
+        rq_enqueue(rq, task);
+    } else {
+        task->state = TASK_ZOMBIE;
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+    spin_unlock_irqrestore(&task_lock, tflags);
+    return 0;
 }
 
 task_t *task_get_current(void) {
-    return &tasks[current_task];
+    if (!scheduler_enabled) return NULL;
+    return this_cpu()->current;
 }
 
-task_t *task_get_list(void) {
-    return tasks;
+bool task_scheduler_running(void) {
+    return scheduler_enabled;
+}
+
+/* Calls `fn` for every task with task_lock held, so tasks cannot be
+   reaped underneath it; `fn` must not block. */
+void task_for_each(void (*fn)(task_t *task, void *arg), void *arg) {
+    uint64_t flags = spin_lock_irqsave(&task_lock);
+    for (task_t *task = task_list; task; task = task->all_next) fn(task, arg);
+    spin_unlock_irqrestore(&task_lock, flags);
 }
 
 int task_get_count(void) {
+    return (int)nr_tasks;
+}
+
+static void stat_fill(task_stat_t *st, task_t *task, uint64_t now) {
+    st->id = task->id;
+    strncpy(st->name, task->name, TASK_NAME_LEN);
+    st->state = task->state;
+    st->priority = task->priority;
+    st->cpu = task->cpu;
+    st->runtime_ns = task->runtime_ns;
+    st->wait_ns = task->wait_ns;
+    st->nvcsw = task->nvcsw;
+    st->nivcsw = task->nivcsw;
+
+    /* Include the current stint of a task that is on a CPU right now. */
+    uint64_t stamp = task->acct_stamp;
+    if (task->state == TASK_RUNNING && now > stamp) {
+        st->runtime_ns += timer_counter_to_ns(now - stamp);
+    }
+}
+
+/* Copies the accounting of up to `max` tasks, idle tasks last; returns
+   how many were written. */
+int task_get_stats(task_stat_t *out, int max) {
     int count = 0;
-    for (int i = 0; i < MAX_TASKS; i++) {
-        if (tasks[i].state != TASK_UNUSED) count++;
+    uint64_t flags = spin_lock_irqsave(&task_lock);
+    uint64_t now = timer_counter();
+    for (task_t *task = task_list; task && count < max; task = task->all_next) {
+        stat_fill(&out[count++], task, now);
+    }
+    spin_unlock_irqrestore(&task_lock, flags);
+
+    for (uint32_t cpu = 0; cpu < NR_CPUS && count < max; cpu++) {
+        percpu_t *pc = smp_get_cpu(cpu);
+        if (pc->state == CPU_ONLINE && pc->idle) stat_fill(&out[count++], pc->idle, now);
     }
     return count;
 }
+
+const char *task_state_name(uint8_t state) {
+    switch (state) {
+        case TASK_READY:    return "ready";
+        case TASK_RUNNING:  return "run";
+        case TASK_SLEEPING: return "sleep";
+        case TASK_BLOCKED:  return "block";
+        case TASK_ZOMBIE:   return "zombie";
+        default:            return "unused";
+    }
+}
+
+uint32_t task_get_queue_length(uint32_t cpu) {
+    if (cpu >= NR_CPUS) return 0;
+    return runqueues[cpu].nr_queued;
+}
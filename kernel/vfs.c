@@ -4,13 +4,28 @@
 #include "timer.h"
 #include "power.h"
 #include "printf.h"
+#include "spinlock.h"
+#include "sync.h"
+#include "uart.h"
+#include "task.h"
+#include "workqueue.h"
+#include "atomic.h"
 
 static vfs_node_t *root = NULL;
 static vfs_node_t *cwd = NULL;
 static vfs_fd_t fd_table[VFS_MAX_OPEN];
+static kmem_cache_t *node_cache = NULL;
+static arena_t *proc_arena = NULL;
+static rwlock_t tree_lock;
+static spinlock_t fd_lock;
+static mutex_t proc_lock;
+
+#define PROC_BUF_SIZE   1024
+#define HEAPSTAT_TOP    16
+#define PROC_TASK_LINE  128
 
 static vfs_node_t *alloc_node(void) {
-    vfs_node_t *node = (vfs_node_t *)kmalloc(sizeof(vfs_node_t));
+    vfs_node_t *node = (vfs_node_t *)kmem_cache_alloc(node_cache);
     if (node) memset(node, 0, sizeof(vfs_node_t));
     return node;
 }
@@ -42,66 +57,193 @@ static ssize_t dev_random_read(vfs_node_t *node, void *buf, size_t size, size_t
     return (ssize_t)size;
 }
 
-static ssize_t proc_uptime_read(vfs_node_t *node, void *buf, size_t size, size_t offset) {
+static ssize_t dev_console_read(vfs_node_t *node, void *buf, size_t size, size_t offset) {
+    UNUSED(node); UNUSED(offset);
+    if (size == 0) return 0;
+
+    char *p = (char *)buf;
+    size_t n = 0;
+    p[n++] = uart_getc();
+    while (n < size && uart_try_getc(&p[n])) n++;
+    return (ssize_t)n;
+}
+
+static ssize_t dev_console_write(vfs_node_t *node, const void *buf, size_t size, size_t offset) {
     UNUSED(node); UNUSED(offset);
-    char tmp[64];
-    uint64_t s = timer_get_uptime_seconds();
-    ksprintf(tmp, "%u seconds\n", s);
-    size_t len = strlen(tmp);
-    if (size > len) size = len;
-    memcpy(buf, tmp, size);
+    const char *p = (const char *)buf;
+    for (size_t i = 0; i < size; i++) uart_putc(p[i]);
     return (ssize_t)size;
 }
 
+static char *proc_begin(size_t size) {
+    mutex_lock(&proc_lock);
+    return (char *)arena_alloc(proc_arena, size);
+}
+
+static ssize_t proc_finish(const char *text, void *buf, size_t size, size_t offset) {
+    ssize_t ret = -1;
+    if (text) {
+        size_t len = strlen(text);
+        ret = 0;
+        if (offset < len) {
+            if (size > len - offset) size = len - offset;
+            memcpy(buf, text + offset, size);
+            ret = (ssize_t)size;
+        }
+    }
+    arena_reset(proc_arena);
+    mutex_unlock(&proc_lock);
+    return ret;
+}
+
+static ssize_t proc_uptime_read(vfs_node_t *node, void *buf, size_t size, size_t offset) {
+    UNUSED(node);
+    char *tmp = proc_begin(PROC_BUF_SIZE);
+    if (tmp) ksprintf(tmp, "%u seconds\n", timer_get_uptime_seconds());
+    return proc_finish(tmp, buf, size, offset);
+}
+
 static ssize_t proc_meminfo_read(vfs_node_t *node, void *buf, size_t size, size_t offset) {
-    UNUSED(node); UNUSED(offset);
+    UNUSED(node);
     mem_info_t info = mm_get_info();
-    char tmp[256];
-    ksprintf(tmp, "Total:  %u KB\nUsed:   %u KB\nFree:   %u KB\nPages:  %u / %u\n",
-        (uint32_t)(info.total / 1024),
-        (uint32_t)(info.used / 1024),
-        (uint32_t)(info.free / 1024),
-        info.pages_used, info.pages_total);
-    size_t len = strlen(tmp);
-    if (size > len) size = len;
-    memcpy(buf, tmp, size);
-    return (ssize_t)size;
+    char *tmp = proc_begin(PROC_BUF_SIZE);
+    if (tmp) {
+        ksprintf(tmp, "Total:  %u KB\nUsed:   %u KB\nFree:   %u KB\nPages:  %u / %u\n"
+            "Heap:   %u KB / %u KB\nSlab:   %u KB\nLargest: %u KB\nAllocs: %u\nFrees:  %u\n",
+            (uint32_t)(info.total / 1024),
+            (uint32_t)(info.used / 1024),
+            (uint32_t)(info.free / 1024),
+            info.pages_used, info.pages_total,
+            (uint32_t)(info.heap_used / 1024),
+            (uint32_t)(info.heap_total / 1024),
+            (uint32_t)(info.slab_used / 1024),
+            (uint32_t)(info.largest_free / 1024),
+            info.alloc_count, info.free_count);
+    }
+    return proc_finish(tmp, buf, size, offset);
 }
 
 static ssize_t proc_cpuinfo_read(vfs_node_t *node, void *buf, size_t size, size_t offset) {
-    UNUSED(node); UNUSED(offset);
+    UNUSED(node);
     system_power_t pwr = power_get_status();
-    char tmp[256];
-    ksprintf(tmp, "Architecture: AArch64\nARM Clock:    %u MHz\nCore Clock:   %u MHz\nTemperature:  %u C\nProfile:      %s\n",
-        pwr.arm_clock / 1000000,
-        pwr.core_clock / 1000000,
-        pwr.cpu_temp / 1000,
-        power_get_profile_name(pwr.current_profile));
-    size_t len = strlen(tmp);
-    if (size > len) size = len;
-    memcpy(buf, tmp, size);
-    return (ssize_t)size;
+    char *tmp = proc_begin(PROC_BUF_SIZE);
+    if (tmp) {
+        ksprintf(tmp, "Architecture: AArch64\nARM Clock:    %u MHz\nCore Clock:   %u MHz\nTemperature:  %u C\nProfile:      %s\n",
+            pwr.arm_clock / 1000000,
+            pwr.core_clock / 1000000,
+            pwr.cpu_temp / 1000,
+            power_get_profile_name(pwr.current_profile));
+    }
+    return proc_finish(tmp, buf, size, offset);
 }
 
 static ssize_t proc_version_read(vfs_node_t *node, void *buf, size_t size, size_t offset) {
-    UNUSED(node); UNUSED(offset);
-    char tmp[128];
-    ksprintf(tmp, "LareOS %u.%u.%u (%s) AArch64\n",
-        LAREOS_VERSION_MAJOR, LAREOS_VERSION_MINOR, LAREOS_VERSION_PATCH,
-        LAREOS_CODENAME);
-    size_t len = strlen(tmp);
-    if (size > len) size = len;
-    memcpy(buf, tmp, size);
-    return (ssize_t)size;
+    UNUSED(node);
+    char *tmp = proc_begin(PROC_BUF_SIZE);
+    if (tmp) {
+        ksprintf(tmp, "LareOS %u.%u.%u (%s) AArch64\n",
+            LAREOS_VERSION_MAJOR, LAREOS_VERSION_MINOR, LAREOS_VERSION_PATCH,
+            LAREOS_CODENAME);
+    }
+    return proc_finish(tmp, buf, size, offset);
+}
+
+static ssize_t proc_heapstat_read(vfs_node_t *node, void *buf, size_t size, size_t offset) {
+    UNUSED(node);
+    heap_site_t top[HEAPSTAT_TOP];
+    int count = heap_profile_top(top, HEAPSTAT_TOP);
+
+    char *tmp = proc_begin(128 * (HEAPSTAT_TOP + 1));
+    if (tmp) {
+        if (count < 0) {
+            ksprintf(tmp, "Heap profiling disabled (build with -DMM_PROFILE)\n");
+        } else {
+            char *p = tmp + ksprintf(tmp, "%18s %10s %10s %10s %10s\n",
+                "CALLER", "LIVE", "BYTES", "ALLOCS", "FREES");
+            for (int i = 0; i < count; i++) {
+                p += ksprintf(p, "0x%016x %10u %10u %10u %10u\n",
+                    top[i].caller, top[i].live_count, top[i].live_bytes,
+                    top[i].allocs, top[i].frees);
+            }
+        }
+    }
+    return proc_finish(tmp, buf, size, offset);
+}
+
+static ssize_t proc_tasks_read(vfs_node_t *node, void *buf, size_t size, size_t offset) {
+    UNUSED(node);
+    int max = task_get_count() + NR_CPUS + 4;
+
+    char *tmp = proc_begin(PROC_TASK_LINE * (max + 1));
+    task_stat_t *stats = (task_stat_t *)arena_alloc(proc_arena, sizeof(task_stat_t) * max);
+    if (tmp && stats) {
+        int count = task_get_stats(stats, max);
+        char *p = tmp + ksprintf(tmp, "%5s %3s %3s %6s %12s %12s %8s %8s  %s\n",
+            "ID", "CPU", "PRI", "STATE", "RUN_US", "WAIT_US", "VCSW", "IVCSW", "NAME");
+        for (int i = 0; i < count; i++) {
+            task_stat_t *st = &stats[i];
+            p += ksprintf(p, "%5u %3u %3u %6s %12u %12u %8u %8u  %s\n",
+                (uint64_t)st->id, (uint64_t)st->cpu, (uint64_t)st->priority,
+                task_state_name(st->state), st->runtime_ns / 1000, st->wait_ns / 1000,
+                st->nvcsw, st->nivcsw, st->name);
+        }
+    } else {
+        tmp = NULL;
+    }
+    return proc_finish(tmp, buf, size, offset);
+}
+
+static char *proc_defer_line(char *p, uint32_t cpu, const char *kind, const defer_stats_t *st) {
+    uint64_t avg = st->run ? st->latency_ns / st->run : 0;
+    return p + ksprintf(p, "%3u %8s %10u %10u %6u %6u %9u %9u\n",
+        (uint64_t)cpu, kind, st->queued, st->run, (uint64_t)st->depth,
+        (uint64_t)st->max_depth, avg / 1000, st->max_latency_ns / 1000);
+}
+
+static ssize_t proc_workqueues_read(vfs_node_t *node, void *buf, size_t size, size_t offset) {
+    UNUSED(node);
+    char *tmp = proc_begin(PROC_BUF_SIZE);
+    if (tmp) {
+        char *p = tmp + ksprintf(tmp, "%3s %8s %10s %10s %6s %6s %9s %9s\n",
+            "CPU", "KIND", "QUEUED", "RUN", "DEPTH", "MAX", "AVG_US", "MAX_US");
+        for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+            if (smp_get_cpu(cpu)->state != CPU_ONLINE) continue;
+            defer_stats_t tasklets, works;
+            workqueue_get_stats(cpu, &tasklets, &works);
+            p = proc_defer_line(p, cpu, "tasklet", &tasklets);
+            p = proc_defer_line(p, cpu, "work", &works);
+        }
+    }
+    return proc_finish(tmp, buf, size, offset);
+}
+
+static vfs_node_t *find_child(vfs_node_t *parent, const char *name) {
+    if (!parent || parent->type != VFS_DIRECTORY) return NULL;
+
+    if (strcmp(name, ".") == 0) return parent;
+    if (strcmp(name, "..") == 0) return parent->parent ? parent->parent : parent;
+
+    vfs_node_t *child = parent->children;
+    while (child) {
+        if (strcmp(child->name, name) == 0) return child;
+        child = child->next;
+    }
+    return NULL;
 }
 
 vfs_node_t *vfs_create(vfs_node_t *parent, const char *name, uint8_t type) {
     if (!parent || parent->type != VFS_DIRECTORY) return NULL;
-    if (vfs_find_child(parent, name)) return NULL;
 
     vfs_node_t *node = alloc_node();
     if (!node) return NULL;
 
+    uint64_t flags = write_lock_irqsave(&tree_lock);
+    if (find_child(parent, name)) {
+        write_unlock_irqrestore(&tree_lock, flags);
+        kmem_cache_free(node_cache, node);
+        return NULL;
+    }
+
     strncpy(node->name, name, VFS_MAX_NAME - 1);
     node->type = type;
     node->parent = parent;
@@ -111,16 +253,32 @@ vfs_node_t *vfs_create(vfs_node_t *parent, const char *name, uint8_t type) {
 
     node->next = parent->children;
     parent->children = node;
+    write_unlock_irqrestore(&tree_lock, flags);
 
     return node;
 }
 
+static void node_free(vfs_node_t *node) {
+    if (node->data) kfree(node->data);
+    kmem_cache_free(node_cache, node);
+}
+
+static void node_put(vfs_node_t *node) {
+    uint64_t flags = write_lock_irqsave(&tree_lock);
+    bool last = atomic_fetch_add32_acquire(&node->refs, -1) == 1 && node->unlinked;
+    write_unlock_irqrestore(&tree_lock, flags);
+    if (last) node_free(node);
+}
+
 int vfs_remove(vfs_node_t *node) {
     if (!node || node == root) return -1;
-    if (node->type == VFS_DIRECTORY && node->children) return -1;
 
+    uint64_t flags = write_lock_irqsave(&tree_lock);
     vfs_node_t *parent = node->parent;
-    if (!parent) return -1;
+    if (!parent || (node->type == VFS_DIRECTORY && node->children)) {
+        write_unlock_irqrestore(&tree_lock, flags);
+        return -1;
+    }
 
     vfs_node_t **pp = &parent->children;
     while (*pp) {
@@ -130,24 +288,20 @@ int vfs_remove(vfs_node_t *node) {
         }
         pp = &(*pp)->next;
     }
+    /* Open descriptors keep it until the last one is closed. */
+    node->unlinked = true;
+    bool busy = node->refs != 0;
+    write_unlock_irqrestore(&tree_lock, flags);
 
-    if (node->data) kfree(node->data);
-    kfree(node);
+    if (!busy) node_free(node);
     return 0;
 }
 
 vfs_node_t *vfs_find_child(vfs_node_t *parent, const char *name) {
-    if (!parent || parent->type != VFS_DIRECTORY) return NULL;
-
-    if (strcmp(name, ".") == 0) return parent;
-    if (strcmp(name, "..") == 0) return parent->parent ? parent->parent : parent;
-
-    vfs_node_t *child = parent->children;
-    while (child) {
-        if (strcmp(child->name, name) == 0) return child;
-        child = child->next;
-    }
-    return NULL;
+    uint64_t flags = read_lock_irqsave(&tree_lock);
+    vfs_node_t *child = find_child(parent, name);
+    read_unlock_irqrestore(&tree_lock, flags);
+    return child;
 }
 
 vfs_node_t *vfs_resolve_path(const char *path) {
@@ -157,6 +311,7 @@ vfs_node_t *vfs_resolve_path(const char *path) {
     if (*path == '/') path++;
 
     char component[VFS_MAX_NAME];
+    uint64_t flags = read_lock_irqsave(&tree_lock);
     while (*path) {
         int i = 0;
         while (*path && *path != '/' && i < VFS_MAX_NAME - 1) {
@@ -166,9 +321,10 @@ vfs_node_t *vfs_resolve_path(const char *path) {
         if (*path == '/') path++;
         if (i == 0) continue;
 
-        node = vfs_find_child(node, component);
-        if (!node) return NULL;
+        node = find_child(node, component);
+        if (!node) break;
     }
+    read_unlock_irqrestore(&tree_lock, flags);
     return node;
 }
 
@@ -180,11 +336,10 @@ void vfs_get_path(vfs_node_t *node, char *buf, size_t size) {
         return;
     }
 
-    char tmp[VFS_MAX_PATH];
-    tmp[0] = '\0';
     vfs_node_t *parts[32];
     int depth = 0;
 
+    uint64_t flags = read_lock_irqsave(&tree_lock);
     vfs_node_t *n = node;
     while (n && n != root && depth < 32) {
         parts[depth++] = n;
@@ -196,6 +351,7 @@ void vfs_get_path(vfs_node_t *node, char *buf, size_t size) {
         strcat(buf, "/");
         strcat(buf, parts[i]->name);
     }
+    read_unlock_irqrestore(&tree_lock, flags);
     if (buf[0] == '\0') strncpy(buf, "/", size);
 }
 
@@ -205,41 +361,54 @@ ssize_t vfs_read(vfs_node_t *node, void *buf, size_t size, size_t offset) {
     if (node->read_fn) return node->read_fn(node, buf, size, offset);
 
     if (node->type != VFS_FILE) return -1;
-    if (offset >= node->size) return 0;
 
-    size_t avail = node->size - offset;
-    if (size > avail) size = avail;
-    memcpy(buf, node->data + offset, size);
+    uint64_t flags = read_lock_irqsave(&tree_lock);
+    if (offset >= node->size) size = 0;
+    else if (size > node->size - offset) size = node->size - offset;
+    if (size) memcpy(buf, node->data + offset, size);
+    read_unlock_irqrestore(&tree_lock, flags);
     return (ssize_t)size;
 }
 
-ssize_t vfs_write(vfs_node_t *node, const void *buf, size_t size, size_t offset) {
+/* VFS_OFFSET_END appends; *offset is set to where the data went. */
+static ssize_t node_write(vfs_node_t *node, const void *buf, size_t size, size_t *offset_p) {
     if (!node || !buf) return -1;
 
-    if (node->write_fn) return node->write_fn(node, buf, size, offset);
+    if (node->write_fn) {
+        if (*offset_p == VFS_OFFSET_END) *offset_p = 0;
+        return node->write_fn(node, buf, size, *offset_p);
+    }
 
     if (node->type != VFS_FILE) return -1;
 
+    uint64_t flags = write_lock_irqsave(&tree_lock);
+    if (*offset_p == VFS_OFFSET_END) *offset_p = node->size;
+    size_t offset = *offset_p;
     size_t needed = offset + size;
     if (needed > node->capacity) {
-        size_t new_cap = needed * 2;
-        if (new_cap < 256) new_cap = 256;
-        uint8_t *new_data = (uint8_t *)kmalloc(new_cap);
-        if (!new_data) return -1;
-        if (node->data) {
-            memcpy(new_data, node->data, node->size);
-            kfree(node->data);
+        size_t new_cap = node->capacity ? node->capacity : 256;
+        while (new_cap < needed) new_cap *= 2;
+        uint8_t *new_data = (uint8_t *)krealloc(node->data, new_cap);
+        if (!new_data) {
+            write_unlock_irqrestore(&tree_lock, flags);
+            return -1;
         }
         node->data = new_data;
-        node->capacity = new_cap;
+        node->capacity = ksize(new_data);
     }
 
+    if (offset > node->size) memset(node->data + node->size, 0, offset - node->size);
     memcpy(node->data + offset, buf, size);
     if (offset + size > node->size) node->size = offset + size;
     node->modified = timer_get_ticks();
+    write_unlock_irqrestore(&tree_lock, flags);
     return (ssize_t)size;
 }
 
+ssize_t vfs_write(vfs_node_t *node, const void *buf, size_t size, size_t offset) {
+    return node_write(node, buf, size, &offset);
+}
+
 int vfs_open(const char *path, uint32_t flags) {
     vfs_node_t *node = vfs_resolve_path(path);
 
@@ -265,54 +434,96 @@ int vfs_open(const char *path, uint32_t flags) {
 
         if (!parent) return -1;
         node = vfs_create(parent, filename, VFS_FILE);
+        if (!node) node = vfs_find_child(parent, filename);
         if (!node) return -1;
     }
 
     if (!node) return -1;
 
+    uint64_t tflags = write_lock_irqsave(&tree_lock);
+    atomic_add32(&node->refs, 1);
+    if (flags & VFS_O_TRUNC) node->size = 0;
+    uint32_t start = (flags & VFS_O_APPEND) ? node->size : 0;
+    write_unlock_irqrestore(&tree_lock, tflags);
+
+    int fd = -1;
+    uint64_t fflags = spin_lock_irqsave(&fd_lock);
     for (int i = 0; i < VFS_MAX_OPEN; i++) {
         if (!fd_table[i].in_use) {
             fd_table[i].node = node;
-            fd_table[i].offset = (flags & VFS_O_APPEND) ? node->size : 0;
+            fd_table[i].offset = start;
             fd_table[i].flags = flags;
             fd_table[i].in_use = true;
-            if (flags & VFS_O_TRUNC) {
-                node->size = 0;
-            }
-            return i;
+            fd = i;
+            break;
         }
     }
-    return -1;
+    spin_unlock_irqrestore(&fd_lock, fflags);
+    if (fd < 0) node_put(node);
+    return fd;
+}
+
+/* Pins the node against a concurrent close and vfs_remove(); release it
+   with node_put(). */
+static bool fd_get(int fd, vfs_fd_t *out) {
+    if (fd < 0 || fd >= VFS_MAX_OPEN) return false;
+    uint64_t flags = spin_lock_irqsave(&fd_lock);
+    bool ok = fd_table[fd].in_use;
+    if (ok) {
+        *out = fd_table[fd];
+        atomic_add32(&out->node->refs, 1);
+    }
+    spin_unlock_irqrestore(&fd_lock, flags);
+    return ok;
+}
+
+static void fd_advance(int fd, vfs_node_t *node, size_t offset) {
+    uint64_t flags = spin_lock_irqsave(&fd_lock);
+    if (fd_table[fd].in_use && fd_table[fd].node == node) fd_table[fd].offset = offset;
+    spin_unlock_irqrestore(&fd_lock, flags);
 }
 
 ssize_t vfs_fd_read(int fd, void *buf, size_t size) {
-    if (fd < 0 || fd >= VFS_MAX_OPEN || !fd_table[fd].in_use) return -1;
-    ssize_t ret = vfs_read(fd_table[fd].node, buf, size, fd_table[fd].offset);
-    if (ret > 0) fd_table[fd].offset += ret;
+    vfs_fd_t desc;
+    if (!fd_get(fd, &desc)) return -1;
+    ssize_t ret = vfs_read(desc.node, buf, size, desc.offset);
+    if (ret > 0) fd_advance(fd, desc.node, desc.offset + ret);
+    node_put(desc.node);
     return ret;
 }
 
 ssize_t vfs_fd_write(int fd, const void *buf, size_t size) {
-    if (fd < 0 || fd >= VFS_MAX_OPEN || !fd_table[fd].in_use) return -1;
-    ssize_t ret = vfs_write(fd_table[fd].node, buf, size, fd_table[fd].offset);
-    if (ret > 0) fd_table[fd].offset += ret;
+    vfs_fd_t desc;
+    if (!fd_get(fd, &desc)) return -1;
+    size_t offset = (desc.flags & VFS_O_APPEND) ? VFS_OFFSET_END : desc.offset;
+    ssize_t ret = node_write(desc.node, buf, size, &offset);
+    if (ret > 0) fd_advance(fd, desc.node, offset + ret);
+    node_put(desc.node);
     return ret;
 }
 
 int vfs_fd_close(int fd) {
-    if (fd < 0 || fd >= VFS_MAX_OPEN || !fd_table[fd].in_use) return -1;
+    if (fd < 0 || fd >= VFS_MAX_OPEN) return -1;
+    uint64_t flags = spin_lock_irqsave(&fd_lock);
+    vfs_node_t *node = fd_table[fd].in_use ? fd_table[fd].node : NULL;
     fd_table[fd].in_use = false;
+    spin_unlock_irqrestore(&fd_lock, flags);
+
+    if (!node) return -1;
+    node_put(node);
     return 0;
 }
 
 uint32_t vfs_count_children(vfs_node_t *dir) {
     if (!dir || dir->type != VFS_DIRECTORY) return 0;
     uint32_t count = 0;
+    uint64_t flags = read_lock_irqsave(&tree_lock);
     vfs_node_t *child = dir->children;
     while (child) {
         count++;
         child = child->next;
     }
+    read_unlock_irqrestore(&tree_lock, flags);
     return count;
 }
 
@@ -332,7 +543,12 @@ static vfs_node_t *create_device(vfs_node_t *parent, const char *name,
 }
 
 void vfs_init(void) {
+    rwlock_init(&tree_lock, "vfs_tree");
+    spin_lock_init(&fd_lock, "vfs_fd");
+    mutex_init(&proc_lock, "vfs_proc");
     memset(fd_table, 0, sizeof(fd_table));
+    if (!node_cache) node_cache = kmem_cache_create("vfs_node", sizeof(vfs_node_t));
+    if (!proc_arena) proc_arena = arena_create(PROC_BUF_SIZE);
 
     root = alloc_node();
     strncpy(root->name, "/", VFS_MAX_NAME);
@@ -348,12 +564,16 @@ void vfs_init(void) {
     create_device(dev, "null", dev_null_read, dev_null_write);
     create_device(dev, "zero", dev_zero_read, dev_null_write);
     create_device(dev, "random", dev_random_read, NULL);
+    create_device(dev, "console", dev_console_read, dev_console_write);
 
     vfs_node_t *proc = vfs_create(root, "proc", VFS_DIRECTORY);
     create_device(proc, "uptime", proc_uptime_read, NULL);
     create_device(proc, "meminfo", proc_meminfo_read, NULL);
     create_device(proc, "cpuinfo", proc_cpuinfo_read, NULL);
     create_device(proc, "version", proc_version_read, NULL);
+    create_device(proc, "heapstat", proc_heapstat_read, NULL);
+    create_device(proc, "tasks", proc_tasks_read, NULL);
+    create_device(proc, "workqueues", proc_workqueues_read, NULL);
 
     vfs_create(root, "tmp", VFS_DIRECTORY);
     vfs_create(root, "home", VFS_DIRECTORY);
@@ -0,0 +1,233 @@
+#include "workqueue.h"
+#include "task.h"
+#include "sync.h"
+#include "smp.h"
+#include "timer.h"
+#include "atomic.h"
+
+/* A pass only runs what was queued when it started; anything scheduled
+   meanwhile, or from task context, is left to the CPU's workers. */
+typedef struct {
+    tasklet_t *head;
+    tasklet_t *tail;
+    defer_stats_t stats;
+} tasklet_queue_t;
+
+/* The wait queue's lock also guards the list and the stats. */
+typedef struct {
+    wait_queue_t wait;
+    work_t *head;
+    work_t *tail;
+    uint32_t workers;
+    work_t softirq_work;
+    defer_stats_t stats;
+} worker_pool_t;
+
+static tasklet_queue_t tasklet_queues[NR_CPUS];
+static worker_pool_t pools[NR_CPUS];
+static volatile bool workqueue_ready = false;
+
+static const char *worker_names[NR_CPUS] = { "worker0", "worker1", "worker2", "worker3" };
+
+static void stats_depth(defer_stats_t *st) {
+    if (++st->depth > st->max_depth) st->max_depth = st->depth;
+}
+
+static void stats_queued(defer_stats_t *st) {
+    st->queued++;
+    stats_depth(st);
+}
+
+static void stats_run(defer_stats_t *st, uint64_t queued_at) {
+    uint64_t latency = timer_counter_to_ns(timer_counter() - queued_at);
+    st->run++;
+    st->latency_ns += latency;
+    if (latency > st->max_latency_ns) st->max_latency_ns = latency;
+}
+
+static void tasklet_append(tasklet_queue_t *q, tasklet_t *t) {
+    t->next = NULL;
+    if (q->tail) q->tail->next = t;
+    else q->head = t;
+    q->tail = t;
+}
+
+void tasklet_init(tasklet_t *t, defer_fn_t fn, void *arg) {
+    t->next = NULL;
+    t->fn = fn;
+    t->arg = arg;
+    t->state = 0;
+    t->queued_at = 0;
+}
+
+/* Returns false if the tasklet was already pending. It may be scheduled
+   again while it runs, and then runs once more afterwards. */
+bool tasklet_schedule(tasklet_t *t) {
+    uint32_t old;
+    do {
+        old = t->state;
+        if (old & TASKLET_SCHED) return false;
+    } while (!atomic_cmpxchg32_acquire(&t->state, old, old | TASKLET_SCHED));
+
+    uint64_t flags = irq_save();
+    percpu_t *pc = this_cpu();
+    uint32_t cpu = pc->id;
+    tasklet_queue_t *q = &tasklet_queues[cpu];
+    t->queued_at = timer_counter();
+    tasklet_append(q, t);
+    stats_queued(&q->stats);
+    bool in_irq = pc->irq_depth != 0;
+    irq_restore(flags);
+
+    if (!in_irq) queue_work_on(cpu, &pools[cpu].softirq_work);
+    return true;
+}
+
+/* Runs this CPU's pending tasklets. irq_depth stays raised throughout,
+   so an interrupt taken meanwhile neither re-enters here nor switches
+   away; its need_resched is left for the caller. */
+void softirq_run(void) {
+    uint64_t flags = irq_save();
+    percpu_t *pc = this_cpu();
+    uint32_t cpu = pc->id;
+    tasklet_queue_t *q = &tasklet_queues[cpu];
+
+    tasklet_t *list = q->head;
+    q->head = NULL;
+    q->tail = NULL;
+    q->stats.depth = 0;
+    if (!list) {
+        irq_restore(flags);
+        return;
+    }
+
+    tasklet_t *busy = NULL;
+    pc->irq_depth++;
+    enable_irq();
+
+    while (list) {
+        tasklet_t *t = list;
+        list = t->next;
+
+        /* Still running on another core: retry on a later pass. */
+        if (!atomic_cmpxchg32_acquire(&t->state, TASKLET_SCHED, TASKLET_RUN)) {
+            t->next = busy;
+            busy = t;
+            continue;
+        }
+
+        stats_run(&q->stats, t->queued_at);
+        t->fn(t->arg);
+        atomic_sub32_release(&t->state, TASKLET_RUN);
+    }
+
+    disable_irq();
+    pc->irq_depth--;
+    /* Counted as queued when scheduled; it still runs only once. */
+    while (busy) {
+        tasklet_t *next = busy->next;
+        tasklet_append(q, busy);
+        stats_depth(&q->stats);
+        busy = next;
+    }
+    bool more = q->head != NULL;
+    irq_restore(flags);
+
+    if (more) queue_work_on(cpu, &pools[cpu].softirq_work);
+}
+
+static void softirq_work_fn(void *arg) {
+    UNUSED(arg);
+    softirq_run();
+    task_check_preempt();
+}
+
+void work_init(work_t *work, defer_fn_t fn, void *arg) {
+    work->next = NULL;
+    work->fn = fn;
+    work->arg = arg;
+    work->pending = 0;
+    work->queued_at = 0;
+}
+
+/* Safe from interrupt context. Returns false if the work was already
+   queued or `cpu` has no workers. */
+bool queue_work_on(uint32_t cpu, work_t *work) {
+    if (!workqueue_ready || cpu >= NR_CPUS) return false;
+
+    worker_pool_t *pool = &pools[cpu];
+    if (!pool->workers) return false;
+    if (!atomic_cmpxchg32_acquire(&work->pending, 0, 1)) return false;
+
+    uint64_t flags = spin_lock_irqsave(&pool->wait.lock);
+    work->next = NULL;
+    work->queued_at = timer_counter();
+    if (pool->tail) pool->tail->next = work;
+    else pool->head = work;
+    pool->tail = work;
+    stats_queued(&pool->stats);
+    wake_up_locked(&pool->wait);
+    spin_unlock_irqrestore(&pool->wait.lock, flags);
+    return true;
+}
+
+bool queue_work(work_t *work) {
+    return queue_work_on(smp_cpu_id(), work);
+}
+
+static void worker_task(void *arg) {
+    uint32_t cpu = (uint32_t)(uint64_t)arg;
+    worker_pool_t *pool = &pools[cpu];
+
+    task_set_affinity(task_get_current()->id, CPU_MASK(cpu));
+    while (smp_cpu_id() != cpu) task_yield();
+
+    while (1) {
+        uint64_t flags = spin_lock_irqsave(&pool->wait.lock);
+        while (!pool->head) flags = wait_queue_wait_locked(&pool->wait, flags);
+
+        work_t *work = pool->head;
+        pool->head = work->next;
+        if (!pool->head) pool->tail = NULL;
+        pool->stats.depth--;
+        stats_run(&pool->stats, work->queued_at);
+        spin_unlock_irqrestore(&pool->wait.lock, flags);
+
+        /* Cleared before the call so the function may queue itself again. */
+        defer_fn_t fn = work->fn;
+        void *fn_arg = work->arg;
+        atomic_store32_release(&work->pending, 0);
+        fn(fn_arg);
+    }
+}
+
+void workqueue_init(void) {
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        wait_queue_init(&pools[cpu].wait, "workqueue");
+        work_init(&pools[cpu].softirq_work, softirq_work_fn, NULL);
+    }
+
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (smp_get_cpu(cpu)->state != CPU_ONLINE) continue;
+        for (uint32_t i = 0; i < WORKQUEUE_WORKERS; i++) {
+            if (task_create(worker_names[cpu], worker_task, (void *)(uint64_t)cpu, TASK_PRIO_HIGH) > 0) {
+                pools[cpu].workers++;
+            }
+        }
+    }
+
+    asm volatile("dmb ish" ::: "memory");
+    workqueue_ready = true;
+}
+
+void workqueue_get_stats(uint32_t cpu, defer_stats_t *tasklets, defer_stats_t *works) {
+    if (cpu >= NR_CPUS) return;
+
+    uint64_t flags = irq_save();
+    *tasklets = tasklet_queues[cpu].stats;
+    irq_restore(flags);
+
+    flags = spin_lock_irqsave(&pools[cpu].wait.lock);
+    *works = pools[cpu].stats;
+    spin_unlock_irqrestore(&pools[cpu].wait.lock, flags);
+}
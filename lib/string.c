@@ -66,6 +66,17 @@ void *memcpy(void *dst, const void *src, size_t n) {
     return dst;
 }
 
+/* Copies backwards when `dst` overlaps the tail of `src`. */
+void *memmove(void *dst, const void *src, size_t n) {
+    uint8_t *d = (uint8_t*)dst;
+    const uint8_t *s = (const uint8_t*)src;
+    if (d <= s || d >= s + n) return memcpy(dst, src, n);
+    d += n;
+    s += n;
+    while (n--) *--d = *--s;
+    return dst;
+}
+
 int memcmp(const void *s1, const void *s2, size_t n) {
     const uint8_t *a = (const uint8_t*)s1;
     const uint8_t *b = (const uint8_t*)s2;